@@ -91,13 +91,14 @@
       int start = stack[--sp];                                                 \
       if (start >= end)                                                        \
         continue;                                                              \
-      int pivot = start + (end - start) / 2;                                   \
+      /* By value, swaps below can move the element out of its slot */         \
+      typeof(*xs.items) pivot = xs.items[start + (end - start) / 2];           \
       int left = start;                                                        \
       int right = end;                                                         \
       while (left <= right) {                                                  \
-        while (cmp(xs.items[left], xs.items[pivot]) < 0)                       \
+        while (cmp(xs.items[left], pivot) < 0)                                 \
           left++;                                                              \
-        while (cmp(xs.items[right], xs.items[pivot]) > 0)                      \
+        while (cmp(xs.items[right], pivot) > 0)                                \
           right--;                                                             \
         if (left <= right) {                                                   \
           da_swap(xs, left, right);                                            \
@@ -105,11 +106,15 @@
           right--;                                                             \
         }                                                                      \
       }                                                                        \
-      if (start < right) {                                                     \
+      /* Smaller side on top, so the stack stays logarithmic */                \
+      if (right - start < end - left) {                                        \
+        stack[sp++] = left;                                                    \
+        stack[sp++] = end;                                                     \
+        stack[sp++] = start;                                                   \
+        stack[sp++] = right;                                                   \
+      } else {                                                                 \
         stack[sp++] = start;                                                   \
         stack[sp++] = right;                                                   \
-      }                                                                        \
-      if (left < end) {                                                        \
         stack[sp++] = left;                                                    \
         stack[sp++] = end;                                                     \
       }                                                                        \
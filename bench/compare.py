@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Compare benchmark results against a stored baseline.
+
+Baselines are recorded per machine with --update (`make bench-baseline`, or
+the first `make bench-compare`), since timings depend on the host CPU even on
+lavapipe.
+
+Every metric is lower-is-better, and metrics a scene doesn't report are
+skipped. A metric regresses when the result exceeds the baseline by more
+than the threshold, in percent. Exits non-zero if any scene regressed or is
+missing from the baseline.
+"""
+
+import argparse
+import json
+import sys
+
+METRICS = [
+    ("startup_ms", None),
+    ("cpu_frame_ms", "p50"),
+    ("cpu_frame_ms", "p99"),
+    ("gpu_frame_ms", "p50"),
+    ("gpu_frame_ms", "p99"),
+    ("cpu_batch_ms", "p50"),
+    ("cpu_batch_ms", "p99"),
+    ("ns_per_element", None),
+    ("vertex_fetch_bytes_per_frame", None),
+    ("draws_per_frame", None),
+    ("peak_rss_kb", None),
+]
+
+
+def metric(result, name, stat):
+    value = result.get(name)
+    if stat is not None:
+        value = value.get(stat) if isinstance(value, dict) else None
+    return value
+
+
+def load_results(paths):
+    results = {}
+    for path in paths:
+        with open(path) as f:
+            result = json.load(f)
+        results[result["scene"]] = result
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline", help="baseline JSON, keyed by scene")
+    parser.add_argument("results", nargs="+", help="per-scene result JSON")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default 10)")
+    parser.add_argument("--update", action="store_true",
+                        help="overwrite the baseline with these results")
+    args = parser.parse_args()
+
+    results = load_results(args.results)
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"wrote baseline for {len(results)} scenes to {args.baseline}")
+        return 0
+
+    try:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        print(f"no baseline at {args.baseline}, create one with "
+              "`make bench-baseline`", file=sys.stderr)
+        return 2
+
+    failed = False
+    for scene, result in sorted(results.items()):
+        base = baseline.get(scene)
+        if base is None:
+            print(f"{scene}: not in baseline")
+            failed = True
+            continue
+
+        for key in ("count", "frames", "seed", "device"):
+            if base.get(key) != result.get(key):
+                print(f"{scene}: warning: {key} differs from baseline "
+                      f"({base.get(key)} vs {result.get(key)})")
+
+        for name, stat in METRICS:
+            label = name if stat is None else f"{name}.{stat}"
+            old = metric(base, name, stat)
+            new = metric(result, name, stat)
+            if not old or new is None:
+                continue
+
+            change = (new - old) / old * 100.0
+            regressed = change > args.threshold
+            failed |= regressed
+            print(f"{scene:<10} {label:<28} {old:>12.3f} -> {new:>12.3f} "
+                  f"{change:+7.1f}%{'  REGRESSION' if regressed else ''}")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Compare frames captured with --capture against reference frames.
+
+Takes two QOI files, or two directories whose QOI files are matched by name.
+A pixel differs when any channel is off by more than the tolerance. Exits
+non-zero if any image differs in more than the allowed fraction of pixels,
+has a different size, or is missing from either side.
+"""
+
+import argparse
+import os
+import sys
+
+
+def decode_qoi(path):
+    """Return (width, height, pixels) with pixels a flat RGBA bytearray."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if data[:4] != b"qoif":
+        raise ValueError(f"{path}: not a QOI file")
+
+    width = int.from_bytes(data[4:8], "big")
+    height = int.from_bytes(data[8:12], "big")
+    pixels = bytearray(width * height * 4)
+    index = [(0, 0, 0, 0)] * 64
+    r, g, b, a = 0, 0, 0, 255
+    p = 14
+    run = 0
+
+    for i in range(0, len(pixels), 4):
+        if run > 0:
+            run -= 1
+        else:
+            op = data[p]
+            p += 1
+            if op == 0xFE:
+                r, g, b = data[p], data[p + 1], data[p + 2]
+                p += 3
+            elif op == 0xFF:
+                r, g, b, a = data[p], data[p + 1], data[p + 2], data[p + 3]
+                p += 4
+            elif op >> 6 == 0:
+                r, g, b, a = index[op]
+            elif op >> 6 == 1:
+                r = (r + ((op >> 4) & 3) - 2) & 0xFF
+                g = (g + ((op >> 2) & 3) - 2) & 0xFF
+                b = (b + (op & 3) - 2) & 0xFF
+            elif op >> 6 == 2:
+                dg = (op & 0x3F) - 32
+                second = data[p]
+                p += 1
+                r = (r + dg + (second >> 4) - 8) & 0xFF
+                g = (g + dg) & 0xFF
+                b = (b + dg + (second & 0xF) - 8) & 0xFF
+            else:
+                run = op & 0x3F
+
+            index[(r * 3 + g * 5 + b * 7 + a * 11) % 64] = (r, g, b, a)
+
+        pixels[i:i + 4] = bytes((r, g, b, a))
+
+    return width, height, pixels
+
+
+def diff_images(reference, result, tolerance):
+    """Return the fraction of differing pixels, or None on size mismatch."""
+    ref_width, ref_height, ref_pixels = decode_qoi(reference)
+    width, height, pixels = decode_qoi(result)
+    if (ref_width, ref_height) != (width, height):
+        return None
+
+    differing = 0
+    for i in range(0, len(pixels), 4):
+        for c in range(4):
+            if abs(pixels[i + c] - ref_pixels[i + c]) > tolerance:
+                differing += 1
+                break
+
+    return differing / (width * height)
+
+
+def pairs(reference, result):
+    if not os.path.isdir(reference):
+        return [(os.path.basename(result), reference, result)]
+
+    names = sorted(set(os.listdir(reference)) | set(os.listdir(result)))
+    return [(name, os.path.join(reference, name), os.path.join(result, name))
+            for name in names if name.endswith(".qoi")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("reference", help="reference QOI file or directory")
+    parser.add_argument("result", help="captured QOI file or directory")
+    parser.add_argument("--tolerance", type=int, default=2,
+                        help="allowed difference per channel (default 2)")
+    parser.add_argument("--max-fraction", type=float, default=0.001,
+                        help="allowed fraction of differing pixels "
+                        "(default 0.001)")
+    args = parser.parse_args()
+
+    failed = False
+    for name, reference, result in pairs(args.reference, args.result):
+        if not os.path.exists(reference) or not os.path.exists(result):
+            missing = "reference" if not os.path.exists(reference) else "result"
+            print(f"{name}: missing {missing}")
+            failed = True
+            continue
+
+        fraction = diff_images(reference, result, args.tolerance)
+        if fraction is None:
+            print(f"{name}: size differs")
+            failed = True
+            continue
+
+        differs = fraction > args.max_fraction
+        failed |= differs
+        print(f"{name:<24} {fraction * 100:8.4f}% differ"
+              f"{'  MISMATCH' if differs else ''}")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
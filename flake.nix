@@ -42,6 +42,7 @@
         nativeBuildInputs = [
           pkg-config
           gnumake
+          shaderc
         ];
 
         packages = [
@@ -49,10 +50,15 @@
           # llvm_17
           # lldb_17
           bear
+          python3
+        ] ++ lib.optionals stdenv.isLinux [
+          # lavapipe, the software rasterizer used by `make bench`
+          mesa
         ];
 
         VK_LAYER_PATH = "${vulkan-validation-layers}/share/vulkan/explicit_layer.d";
         VK_ICD_FILENAMES = "${moltenvk}/share/vulkan/icd.d/MoltenVK_icd.json";
+        LAVAPIPE_ICD = lib.optionalString stdenv.isLinux "${mesa.drivers}/share/vulkan/icd.d/lvp_icd.${stdenv.hostPlatform.parsed.cpu.name}.json";
       };
     };
   }));
@@ -3,18 +3,38 @@
 
 #include <GLFW/glfw3.h>
 #include <assert.h>
+#include <errno.h>
 #include <float.h>
 #include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "arrays.h"
 
-#define DEBUG true
+// DEBUG is set by the build configuration, see the Makefile
 #define MAX_LAYER_COUNT 20
 
+// Least severe validation message that is subscribed to
+#ifndef LOG_MIN_SEVERITY
+#define LOG_MIN_SEVERITY VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+#endif
+
+#ifndef SHADER_DIR
+#define SHADER_DIR "build/shaders"
+#endif
+
 #define optional(type)                                                         \
   struct {                                                                     \
     bool present;                                                              \
@@ -26,10 +46,11 @@ const uint32_t WIDTH = 800;
 
 const char *validation_layers[] = {"VK_LAYER_KHRONOS_validation"};
 const char *device_extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+// const so release builds drop every validation branch at compile time
 #ifdef DEBUG
-bool enable_validation_layers = true;
+const bool enable_validation_layers = true;
 #else
-bool enable_validation_layers = false;
+const bool enable_validation_layers = false;
 #endif
 
 #define error(...)                                                             \
@@ -55,20 +76,644 @@ typedef struct {
   uint32_t capacity;
 } swapchain_image_views_da_t;
 
+#define PIPELINE_KEY_MAX_BINDINGS 2
+#define PIPELINE_KEY_MAX_ATTRIBUTES 8
+
+// Everything that goes into a graphics pipeline. Keys are hashed and compared
+// bytewise, so always start from pipeline_key_init() to zero the padding.
+typedef struct {
+  VkShaderModule vertex_shader;
+  VkShaderModule fragment_shader;
+  VkPipelineLayout layout;
+  VkRenderPass render_pass;
+  VkFormat color_format;
+  VkFormat depth_format;
+  VkPrimitiveTopology topology;
+  VkCullModeFlags cull_mode;
+  uint32_t binding_count;
+  VkVertexInputBindingDescription bindings[PIPELINE_KEY_MAX_BINDINGS];
+  uint32_t attribute_count;
+  VkVertexInputAttributeDescription attributes[PIPELINE_KEY_MAX_ATTRIBUTES];
+  VkBool32 blend_enable;
+  VkBool32 depth_test_enable;
+  VkBool32 depth_write_enable;
+  VkCompareOp depth_compare_op;
+} pipeline_key_t;
+
+typedef enum {
+  PIPELINE_ENTRY_EMPTY = 0,
+  PIPELINE_ENTRY_PENDING,
+  PIPELINE_ENTRY_READY,
+  PIPELINE_ENTRY_FAILED,
+} pipeline_entry_state_t;
+
+typedef struct {
+  pipeline_key_t key;
+  uint64_t hash;
+  pipeline_entry_state_t state;
+  VkPipeline pipeline;
+} pipeline_entry_t;
+
+typedef struct {
+  pipeline_key_t key;
+  uint64_t hash;
+  VkPipeline pipeline;
+  VkResult result;
+} pipeline_job_t;
+
+typedef struct {
+  pipeline_job_t *items;
+  size_t count;
+  size_t capacity;
+} pipeline_jobs_da_t;
+
+typedef struct {
+  VkDevice device;
+  VkPipelineCache vk_cache;
+
+  // Open-addressed table, only touched by the thread calling
+  // pipeline_cache_get/pipeline_cache_poll.
+  pipeline_entry_t *entries;
+  uint32_t entries_capacity;
+  uint32_t entries_count;
+
+  // Shared with the compile worker, guarded by mutex.
+  pthread_t worker;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pipeline_jobs_da_t queued;
+  pipeline_jobs_da_t completed;
+  uint32_t in_flight;
+  bool running;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t compiled;
+  uint64_t failed;
+} pipeline_cache_t;
+
+#define MAX_FRAMES_IN_FLIGHT 2
+
+typedef struct {
+  VkDescriptorPool *items;
+  uint32_t count;
+  uint32_t capacity;
+} descriptor_pools_da_t;
+
+typedef struct {
+  VkDescriptorSetLayoutBinding *items;
+  uint32_t count;
+  uint32_t capacity;
+} descriptor_bindings_da_t;
+
+typedef struct {
+  uint64_t hash;
+  descriptor_bindings_da_t bindings;
+  VkDescriptorSetLayout layout;
+} descriptor_layout_entry_t;
+
+
+// One descriptor per binding. Hashed bytewise for the immutable set cache, so
+// zero-initialize before filling in.
+typedef struct {
+  uint32_t binding;
+  VkDescriptorType type;
+  VkDescriptorImageInfo image;
+  VkDescriptorBufferInfo buffer;
+} descriptor_write_t;
+
+#define DESCRIPTOR_SET_MAX_WRITES 8
+
+// Keyed on the layout and the writes, which are kept to tell hash collisions
+// apart
+typedef struct {
+  uint64_t hash;
+  VkDescriptorSetLayout layout;
+  uint32_t write_count;
+  descriptor_write_t writes[DESCRIPTOR_SET_MAX_WRITES];
+  VkDescriptorPool pool;
+  VkDescriptorSet set;
+  // Evicted slot, probing continues past it
+  bool released;
+} descriptor_immutable_set_t;
+
+typedef struct {
+  // Back the immutable set cache. Created with FREE_DESCRIPTOR_SET_BIT so
+  // evicted sets can be freed one by one; sets are only ever allocated from
+  // the last pool.
+  descriptor_pools_da_t pools;
+  uint32_t sets_per_pool;
+
+  // Open addressing, empty slots have no layout
+  descriptor_layout_entry_t *layouts;
+  uint32_t layouts_capacity;
+  uint32_t layouts_count;
+
+  // Open addressing, empty slots have no set. Count includes released slots.
+  descriptor_immutable_set_t *immutable_sets;
+  uint32_t immutable_sets_capacity;
+  uint32_t immutable_sets_count;
+  uint32_t immutable_sets_live;
+
+  uint32_t pools_created;
+} descriptor_allocator_t;
+
+typedef struct {
+  VkDeviceMemory *items;
+  uint32_t count;
+  uint32_t capacity;
+} device_memories_da_t;
+
+typedef struct {
+  VkFramebuffer *items;
+  uint32_t count;
+  uint32_t capacity;
+} framebuffers_da_t;
+
+typedef struct {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  uint32_t type;
+  // Left behind by a free so probing continues past it
+  bool freed;
+} memory_allocation_t;
+
+typedef struct {
+  // Open addressing on the handle, so a free can find its size and type
+  memory_allocation_t *slots;
+  uint32_t capacity;
+  // Live and freed slots, rehashed before this passes half the capacity
+  uint32_t used;
+
+  VkDeviceSize bytes[VK_MAX_MEMORY_TYPES];
+  uint32_t allocations[VK_MAX_MEMORY_TYPES];
+  // Copied through staging buffers into device-local memory
+  uint64_t uploaded_bytes;
+} memory_tracker_t;
+
+typedef struct {
+  VkSemaphore *items;
+  uint32_t count;
+  uint32_t capacity;
+} semaphores_da_t;
+
+typedef enum {
+  APP_MODE_WINDOWED,
+  // No window, surface or swapchain. Frames are rendered into offscreen
+  // images, used by the benchmarks.
+  APP_MODE_HEADLESS,
+  // No window, surface or render targets at all, only a compute queue
+  // running batches of dispatches
+  APP_MODE_COMPUTE,
+} app_mode_t;
+
+// Synthetic scene, fully determined by its counts and seed
+typedef struct {
+  uint32_t triangles;
+  uint32_t instances;
+  uint32_t draws;
+  uint32_t textures;
+  // Instances of the ingested meshes, drawn after the triangles
+  uint32_t meshes;
+  uint64_t seed;
+} scene_desc_t;
+
+// Where a texture image's memory lives, see texture_block_t
+typedef struct {
+  uint32_t block;
+  uint32_t index;
+} texture_slot_t;
+
+typedef struct {
+  texture_slot_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} texture_slots_da_t;
+
+typedef struct {
+  VkImage image;
+  texture_slot_t slot;
+  VkImageView view;
+  VkDeviceSize bytes;
+  // Mip of the full chain that is mip 0 of image
+  uint32_t resident_mip;
+  uint32_t desired_mip;
+  uint64_t last_used_frame;
+  // Immutable set for view, released whenever the image is replaced
+  VkDescriptorSet descriptor_set;
+  uint8_t colors[2][4];
+} texture_t;
+
+typedef struct {
+  texture_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} textures_da_t;
+
+#define MESH_MAX_LODS 4
+
+// One level of detail, as ranges of the shared mesh buffers
+typedef struct {
+  uint32_t first_index;
+  uint32_t index_count;
+  int32_t vertex_offset;
+  uint32_t vertex_count;
+  // Simulated post-transform cache misses per triangle
+  float acmr;
+} mesh_lod_t;
+
+typedef struct {
+  mesh_lod_t lods[MESH_MAX_LODS];
+  uint32_t lod_count;
+} mesh_t;
+
+typedef struct {
+  mesh_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} meshes_da_t;
+
+typedef struct {
+  float offset[2];
+  float scale;
+  uint32_t mesh;
+} mesh_instance_t;
+
+typedef struct {
+  mesh_instance_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} mesh_instances_da_t;
+
+typedef struct {
+  // From ingestion, ACMR weighted by LOD 0 triangle count
+  uint64_t source_vertices;
+  uint64_t unique_vertices;
+  double acmr_before;
+  double acmr_after;
+  VkDeviceSize float_vertex_bytes;
+  VkDeviceSize vertex_bytes;
+  VkDeviceSize index_bytes;
+
+  // Last frame, summed over every window. Vertex fetches are estimated from
+  // each drawn LOD's ACMR.
+  uint64_t frame_number;
+  uint32_t draws;
+  uint32_t buffer_binds;
+  uint64_t indices;
+  double vertex_fetches;
+} mesh_stats_t;
+
+typedef struct {
+  scene_desc_t desc;
+  VkBuffer vertex_buffer;
+  VkDeviceMemory vertex_memory;
+  VkBuffer instance_buffer;
+  VkDeviceMemory instance_memory;
+  textures_da_t textures;
+  VkSampler sampler;
+  VkDescriptorSetLayout set_layout;
+  // Half-extent of each triangle in NDC
+  float triangle_size;
+  VkShaderModule vertex_shader;
+  VkShaderModule fragment_shader;
+  VkPipelineLayout pipeline_layout;
+  pipeline_key_t pipeline_key;
+
+  // Every mesh and LOD lives in one vertex and one index buffer
+  meshes_da_t meshes;
+  mesh_instances_da_t mesh_instances;
+  VkBuffer mesh_vertex_buffer;
+  VkDeviceMemory mesh_vertex_memory;
+  VkBuffer mesh_index_buffer;
+  VkDeviceMemory mesh_index_memory;
+  VkBuffer mesh_instance_buffer;
+  VkDeviceMemory mesh_instance_memory;
+  VkShaderModule mesh_vertex_shader;
+  VkShaderModule mesh_fragment_shader;
+  VkPipelineLayout mesh_pipeline_layout;
+  pipeline_key_t mesh_pipeline_key;
+  mesh_stats_t mesh_stats;
+} scene_t;
+
+#define LOG_QUEUE_CAPACITY 1024
+#define LOG_ID_NAME_MAX 128
+#define LOG_MESSAGE_MAX 1024
+
+typedef struct {
+  VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+  VkDebugUtilsMessageTypeFlagsEXT type;
+  int32_t id_number;
+  char id_name[LOG_ID_NAME_MAX];
+  char text[LOG_MESSAGE_MAX];
+} log_message_t;
+
+typedef struct {
+  _Atomic size_t sequence;
+  log_message_t message;
+} log_cell_t;
+
+typedef struct {
+  uint64_t key;
+  uint64_t count;
+  // First occurrence, later ones only bump count
+  log_message_t message;
+} log_entry_t;
+
+typedef struct {
+  log_entry_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} log_entries_da_t;
+
+typedef struct {
+  log_cell_t *cells;
+  _Atomic size_t enqueue_pos;
+  _Atomic uint64_t dropped;
+  _Atomic bool running;
+  pthread_t thread;
+
+  // Drain thread only
+  size_t dequeue_pos;
+  log_entries_da_t entries;
+  log_entries_da_t performance;
+  uint64_t suppressed;
+  uint64_t rate_limited;
+  double window_start_ms;
+  uint32_t window_printed;
+} logger_t;
+
+typedef struct {
+  VkImage image;
+  VkImageView view;
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet descriptor_set;
+} deferred_destroy_t;
+
+typedef struct {
+  deferred_destroy_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} deferred_destroys_da_t;
+
+typedef struct {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  void *mapped;
+} mapped_buffer_t;
+
+// Host memory that texture mips are generated into and uploaded from
+typedef struct {
+  mapped_buffer_t buffer;
+  VkDeviceSize size;
+  VkDeviceSize used;
+} texture_staging_t;
+
+#define TEXTURE_MAX_MIPS 16
+
+// Device memory carved into equal slots, each holding one texture image with
+// mips [mip, last]. Entries without memory were freed and get reused.
+typedef struct {
+  VkDeviceMemory memory;
+  uint32_t mip;
+  uint32_t free_count;
+} texture_block_t;
+
+typedef struct {
+  texture_block_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} texture_blocks_da_t;
+
+typedef struct {
+  bool memory_budget_supported;
+  VkDeviceSize budget_override;
+  VkDeviceSize budget;
+  // Allocation sizes, comparable with the heap usage the budget comes from
+  VkDeviceSize resident_bytes;
+  // Slot size of a texture image holding mips [mip, last], its allocation
+  // size rounded up to its alignment
+  VkDeviceSize image_bytes[TEXTURE_MAX_MIPS];
+  uint32_t image_memory_types[TEXTURE_MAX_MIPS];
+  uint32_t slots_per_block[TEXTURE_MAX_MIPS];
+  texture_blocks_da_t blocks;
+  texture_slots_da_t free_slots[TEXTURE_MAX_MIPS];
+  // Empty blocks per mip, at most one is kept
+  uint32_t spare_blocks[TEXTURE_MAX_MIPS];
+  // Slots of images replaced by a frame slot, reusable once its fence has
+  // signalled
+  texture_slots_da_t retired_slots[MAX_FRAMES_IN_FLIGHT];
+  // Memory held by blocks, including free slots
+  VkDeviceSize block_bytes;
+  // One per frame slot, reused once its fence has signalled. Its size caps
+  // the texture data a frame generates and uploads.
+  texture_staging_t staging[MAX_FRAMES_IN_FLIGHT];
+  VkDeviceSize uploaded_bytes;
+  uint64_t uploads;
+  uint64_t evictions;
+  uint32_t cursor;
+} texture_streaming_t;
+
+typedef struct {
+  mapped_buffer_t input;
+  mapped_buffer_t output;
+  VkDescriptorSet descriptor_set;
+  // Batch last submitted from this slot, and the timeline value it signals.
+  // 0 once its output has been read back.
+  uint64_t batch;
+  uint64_t timeline_value;
+} compute_slot_t;
+
+typedef struct {
+  // Pixels processed per batch, split evenly over the dispatches
+  uint32_t elements;
+  uint32_t dispatches;
+  VkShaderModule shader;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+  VkSemaphore timeline;
+  PFN_vkWaitSemaphoresKHR wait_semaphores;
+  compute_slot_t slots[MAX_FRAMES_IN_FLIGHT];
+  // Batches submitted, also the last value signalled on the timeline
+  uint64_t submitted;
+  uint64_t mismatches;
+} compute_t;
+
+#define CAPTURE_RING_SIZE 4
+
+typedef enum {
+  CAPTURE_SLOT_FREE = 0,
+  // Copy recorded, waiting on its frame's fence
+  CAPTURE_SLOT_PENDING,
+  // Owned by the encode worker
+  CAPTURE_SLOT_ENCODING,
+} capture_slot_state_t;
+
+typedef struct {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  const uint8_t *mapped;
+  capture_slot_state_t state;
+  // Frame slot whose fence guards the copy
+  uint32_t frame_slot;
+  uint64_t frame_number;
+} capture_slot_t;
+
+typedef struct {
+  // Capturing is off while every is 0
+  uint32_t every;
+  // QOI file per frame, NULL to skip
+  const char *directory;
+  // Raw RGBA8 frames back to back, NULL to skip
+  FILE *raw_stream;
+  uint32_t width;
+  uint32_t height;
+  // Source is BGRA
+  bool swizzle;
+  capture_slot_t slots[CAPTURE_RING_SIZE];
+
+  // Shared with the encode worker, guarded by mutex. Slot states too.
+  pthread_t worker;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t queue[CAPTURE_RING_SIZE];
+  uint32_t queue_head;
+  uint32_t queue_count;
+  bool running;
+
+  uint64_t captured;
+  uint64_t dropped;
+  // Written by the worker, read once it has stopped
+  uint64_t encoded_bytes;
+} capture_t;
+
+// Must be a power of two
+#define TELEMETRY_RING_CAPACITY 256
+#define TELEMETRY_HISTOGRAM_BUCKETS 9
+
+// Everything the frame loop reports about one frame
+typedef struct {
+  uint64_t frame_number;
+  double time_ms;
+  double cpu_frame_ms;
+  // Negative if the frame had no timestamps
+  double gpu_frame_ms;
+  VkDeviceSize memory_bytes[VK_MAX_MEMORY_TYPES];
+  uint32_t memory_allocations[VK_MAX_MEMORY_TYPES];
+  uint32_t descriptor_pools_created;
+  uint32_t descriptor_pools_in_use;
+  uint32_t descriptor_sets_cached;
+  uint64_t pipeline_hits;
+  uint64_t pipeline_misses;
+  uint64_t uploaded_bytes;
+} telemetry_sample_t;
+
+typedef struct {
+  // Not cumulative, summed up when written
+  uint64_t buckets[TELEMETRY_HISTOGRAM_BUCKETS];
+  uint64_t count;
+  double sum_seconds;
+} telemetry_histogram_t;
+
+typedef struct {
+  // Either or both, telemetry is off unless one is set
+  const char *socket_path;
+  const char *file_path;
+  uint32_t interval_ms;
+  bool enabled;
+  uint32_t memory_type_count;
+  uint32_t memory_heaps[VK_MAX_MEMORY_TYPES];
+
+  // Single producer ring, pushed by the frame loop and drained by the worker
+  telemetry_sample_t *ring;
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  _Atomic uint64_t dropped;
+  _Atomic bool running;
+  pthread_t worker;
+
+  // Frame loop only
+  double last_frame_ms;
+
+  // Worker only
+  int listen_fd;
+  telemetry_sample_t latest;
+  uint64_t frames;
+  telemetry_histogram_t cpu_frame;
+  telemetry_histogram_t gpu_frame;
+  double rate_time_ms;
+  uint64_t rate_uploaded_bytes;
+  double upload_bytes_per_second;
+} telemetry_t;
+
+// Windows that can be open at once, all presented in one call
+#define MAX_WINDOWS 16
+
+// A render target: a window with its surface and swapchain, or the offscreen
+// images standing in for one when headless
 typedef struct {
   GLFWwindow *window;
+  VkSurfaceKHR surface;
+  VkSwapchainKHR swapchain;
+  // Swapchain images can be copied from, needed for capture
+  bool swapchain_transfer_src;
+  swapchain_images_da_t swapchain_images;
+  VkExtent2D swapchain_extent;
+  swapchain_image_views_da_t swapchain_image_views;
+  device_memories_da_t offscreen_memories;
+  framebuffers_da_t swapchain_framebuffers;
+  VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
+  // One per swapchain image, since presentation holds on to it
+  semaphores_da_t render_finished_semaphores;
+  // Image the frame being recorded renders to
+  uint32_t image_index;
+} window_t;
+
+typedef struct {
+  window_t *items;
+  size_t count;
+  size_t capacity;
+} windows_da_t;
+
+typedef struct {
+  app_mode_t mode;
+  logger_t log;
   VkInstance instance;
   VkDebugUtilsMessengerEXT debug_messenger;
   VkPhysicalDevice physical_device;
   VkDevice device;
   VkQueue graphics_queue;
   VkQueue present_queue;
-  VkSurfaceKHR surface;
-  VkSwapchainKHR swapchain;
-  swapchain_images_da_t swapchain_images;
+  VkQueue compute_queue;
+  // Every window renders the same frame, one render pass each, from a single
+  // command buffer
+  windows_da_t windows;
+  // Shared by every window, since they share the render pass and pipelines
   VkFormat swapchain_image_format;
-  VkExtent2D swapchain_extent;
-  swapchain_image_views_da_t swapchain_image_views;
+  VkRenderPass render_pass;
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
+  VkFence in_flight_fences[MAX_FRAMES_IN_FLIGHT];
+  VkQueryPool timestamp_pool;
+  bool timestamps_supported;
+  bool timestamps_written[MAX_FRAMES_IN_FLIGHT];
+  float timestamp_period;
+  // GPU time of the frame slot that was just recycled, negative if unknown
+  double last_gpu_frame_ms;
+  pipeline_cache_t pipeline_cache;
+  descriptor_allocator_t descriptors;
+  memory_tracker_t memory;
+  uint32_t current_frame;
+  // Frames started so far, starting at 1
+  uint64_t frame_number;
+  deferred_destroys_da_t deletion_queues[MAX_FRAMES_IN_FLIGHT];
+  texture_streaming_t streaming;
+  scene_t scene;
+  compute_t compute;
+  capture_t capture;
+  telemetry_t telemetry;
 } app_t;
 
 typedef struct {
@@ -85,6 +730,286 @@ typedef struct {
 
 typedef optional(uint32_t) optional_uint32_t;
 
+/*********
+ * Hashing
+ *********/
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a, chainable by passing the previous hash as seed
+uint64_t hash_combine(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+uint64_t hash_bytes(const void *data, size_t len) {
+  return hash_combine(HASH_SEED, data, len);
+}
+
+/******
+ * Time
+ ******/
+
+double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*********
+ * Logging
+ *********/
+
+// Validation messages are pushed by the driver thread into a bounded
+// lock-free queue (Vyukov MPSC) and printed by a background thread, so the
+// callback never blocks on stdout.
+
+#define LOG_POLL_INTERVAL_NS 2000000
+#define LOG_RATE_LIMIT_PER_SECOND 20
+
+const char *log_severity_name(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+  switch (severity) {
+  case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
+    return "verbose";
+  case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
+    return "info";
+  case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
+    return "warning";
+  default:
+    return "error";
+  }
+}
+
+// Safe to call from any thread
+void log_push(logger_t *log,
+              VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+              VkDebugUtilsMessageTypeFlagsEXT type,
+              const VkDebugUtilsMessengerCallbackDataEXT *callback_data) {
+  size_t pos = atomic_load_explicit(&log->enqueue_pos, memory_order_relaxed);
+  log_cell_t *cell;
+
+  while (true) {
+    cell = &log->cells[pos & (LOG_QUEUE_CAPACITY - 1)];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&log->enqueue_pos, &pos,
+                                                pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Full, the drain thread is behind. Never block the driver.
+      atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&log->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  log_message_t *message = &cell->message;
+  message->severity = severity;
+  message->type = type;
+  message->id_number = callback_data->messageIdNumber;
+  snprintf(message->id_name, LOG_ID_NAME_MAX, "%s",
+           callback_data->pMessageIdName ? callback_data->pMessageIdName : "");
+  snprintf(message->text, LOG_MESSAGE_MAX, "%s",
+           callback_data->pMessage ? callback_data->pMessage : "");
+
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+}
+
+// Drain thread only
+bool log_pop(logger_t *log, log_message_t *out) {
+  log_cell_t *cell = &log->cells[log->dequeue_pos & (LOG_QUEUE_CAPACITY - 1)];
+  size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+  if ((intptr_t)sequence - (intptr_t)(log->dequeue_pos + 1) < 0) {
+    return false;
+  }
+
+  *out = cell->message;
+  atomic_store_explicit(&cell->sequence,
+                        log->dequeue_pos + LOG_QUEUE_CAPACITY,
+                        memory_order_release);
+  log->dequeue_pos++;
+  return true;
+}
+
+uint64_t log_message_key(const log_message_t *message) {
+  // Some layers leave the ID empty, fall back to the text itself
+  if (message->id_number == 0 && message->id_name[0] == '\0') {
+    return hash_bytes(message->text, strlen(message->text));
+  }
+
+  uint64_t hash = hash_bytes(&message->id_number, sizeof(int32_t));
+  return hash_combine(hash, message->id_name, strlen(message->id_name));
+}
+
+log_entry_t *log_find_entry(log_entries_da_t *entries, uint64_t key) {
+  for (uint32_t i = 0; i < entries->count; i++) {
+    if (entries->items[i].key == key) {
+      return &entries->items[i];
+    }
+  }
+
+  return NULL;
+}
+
+void log_process(logger_t *log, const log_message_t *message) {
+  uint64_t key = log_message_key(message);
+
+  // Performance warnings are only interesting in aggregate, they go to the
+  // shutdown report instead of the console
+  log_entries_da_t *entries =
+      (message->type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT)
+          ? &log->performance
+          : &log->entries;
+
+  log_entry_t *entry = log_find_entry(entries, key);
+  if (entry != NULL) {
+    entry->count++;
+    log->suppressed++;
+    return;
+  }
+
+  log_entry_t new_entry = {.key = key, .count = 1, .message = *message};
+  da_append((*entries), new_entry);
+
+  if (entries == &log->performance) {
+    return;
+  }
+
+  double now = now_ms();
+  if (now - log->window_start_ms >= 1000.0) {
+    log->window_start_ms = now;
+    log->window_printed = 0;
+  }
+
+  if (log->window_printed >= LOG_RATE_LIMIT_PER_SECOND) {
+    log->rate_limited++;
+    return;
+  }
+
+  log->window_printed++;
+  printf("validation layer (%s): %s\n", log_severity_name(message->severity),
+         message->text);
+}
+
+void *log_drain_thread(void *arg) {
+  logger_t *log = arg;
+  log_message_t message;
+
+  while (atomic_load_explicit(&log->running, memory_order_acquire)) {
+    bool drained_any = false;
+    while (log_pop(log, &message)) {
+      log_process(log, &message);
+      drained_any = true;
+    }
+
+    if (drained_any) {
+      fflush(stdout);
+    } else {
+      struct timespec interval = {0, LOG_POLL_INTERVAL_NS};
+      nanosleep(&interval, NULL);
+    }
+  }
+
+  while (log_pop(log, &message)) {
+    log_process(log, &message);
+  }
+
+  return NULL;
+}
+
+// Most frequent first
+int compare_log_entries(const void *left, const void *right) {
+  uint64_t a = ((const log_entry_t *)left)->count;
+  uint64_t b = ((const log_entry_t *)right)->count;
+  return (a < b) - (a > b);
+}
+
+uint64_t log_entries_total(const log_entries_da_t *entries) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < entries->count; i++) {
+    total += entries->items[i].count;
+  }
+  return total;
+}
+
+void create_logger(app_t *app) {
+  logger_t *log = &app->log;
+  *log = (logger_t){0};
+
+  log->cells = malloc(LOG_QUEUE_CAPACITY * sizeof(log_cell_t));
+  for (size_t i = 0; i < LOG_QUEUE_CAPACITY; i++) {
+    atomic_init(&log->cells[i].sequence, i);
+  }
+
+  atomic_init(&log->enqueue_pos, 0);
+  atomic_init(&log->dropped, 0);
+  atomic_init(&log->running, true);
+
+  if (pthread_create(&log->thread, NULL, log_drain_thread, log) != 0) {
+    error("failed to start log thread!");
+  }
+}
+
+void destroy_logger(app_t *app) {
+  logger_t *log = &app->log;
+
+  atomic_store_explicit(&log->running, false, memory_order_release);
+  pthread_join(log->thread, NULL);
+
+  // Rate limited messages are already in their entry's count, they were
+  // only kept off the console
+  uint64_t total =
+      log_entries_total(&log->entries) + log_entries_total(&log->performance);
+  printf("validation layer: %llu messages, %u unique, %llu repeats "
+         "suppressed, %llu rate limited, %llu dropped\n",
+         (unsigned long long)total, log->entries.count,
+         (unsigned long long)log->suppressed,
+         (unsigned long long)log->rate_limited,
+         (unsigned long long)atomic_load(&log->dropped));
+
+  // qsort wants a valid pointer even for no entries
+  if (log->entries.count > 0) {
+    qsort(log->entries.items, log->entries.count, sizeof(log_entry_t),
+          compare_log_entries);
+  }
+  for (uint32_t i = 0; i < log->entries.count; i++) {
+    log_entry_t *entry = &log->entries.items[i];
+    if (entry->count > 1) {
+      printf("  %8llu x %s\n", (unsigned long long)entry->count,
+             entry->message.id_name);
+    }
+  }
+
+  if (log->performance.count > 0) {
+    printf("performance warnings (%u unique):\n", log->performance.count);
+
+    qsort(log->performance.items, log->performance.count, sizeof(log_entry_t),
+          compare_log_entries);
+    for (uint32_t i = 0; i < log->performance.count; i++) {
+      log_entry_t *entry = &log->performance.items[i];
+      printf("  %8llu x %s: %s\n", (unsigned long long)entry->count,
+             entry->message.id_name, entry->message.text);
+    }
+  }
+
+  da_free(log->entries);
+  da_free(log->performance);
+  free(log->cells);
+}
+
 /************
  * Validation
  ************/
@@ -94,7 +1019,7 @@ debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
                VkDebugUtilsMessageTypeFlagsEXT message_type,
                const VkDebugUtilsMessengerCallbackDataEXT *callback_data,
                void *user_data) {
-  printf("validation layer: %s\n", callback_data->pMessage);
+  log_push(user_data, message_severity, message_type, callback_data);
   return VK_FALSE;
 }
 
@@ -152,20 +1077,23 @@ void destroy_debug_utils_messenger_ext(VkInstance instance,
 }
 
 void populate_debug_messenger_create_info(
-    VkDebugUtilsMessengerCreateInfoEXT *create_info) {
+    app_t *app, VkDebugUtilsMessengerCreateInfoEXT *create_info) {
   *create_info = (VkDebugUtilsMessengerCreateInfoEXT){0};
 
-  create_info->sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-  create_info->messageSeverity =
+  // Severity bits grow with severity, subscribe to LOG_MIN_SEVERITY and up
+  VkDebugUtilsMessageSeverityFlagsEXT all_severities =
       VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+      VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
       VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-      /*VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |*/
       VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+
+  create_info->sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+  create_info->messageSeverity = all_severities & ~(LOG_MIN_SEVERITY - 1);
   create_info->messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
                              VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
                              VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
   create_info->pfnUserCallback = debug_callback;
-  create_info->pUserData = NULL;
+  create_info->pUserData = &app->log;
 }
 
 void setup_debug_messenger(app_t *app) {
@@ -174,7 +1102,7 @@ void setup_debug_messenger(app_t *app) {
   }
 
   VkDebugUtilsMessengerCreateInfoEXT create_info;
-  populate_debug_messenger_create_info(&create_info);
+  populate_debug_messenger_create_info(app, &create_info);
 
   if (create_debug_utils_messenger_ext(app->instance, &create_info, NULL,
                                        &app->debug_messenger) != VK_SUCCESS) {
@@ -192,22 +1120,26 @@ typedef struct {
   uint32_t capacity;
 } extension_properties_da_t;
 
-const_strings_da_t get_required_instance_extensions() {
+const_strings_da_t get_required_instance_extensions(app_t *app) {
   const_strings_da_t required_extensions = {0};
 
-  uint32_t glfw_required_extension_count = 0;
-  const char **glfw_extensions =
-      glfwGetRequiredInstanceExtensions(&glfw_required_extension_count);
+  // Headless and compute runs create no surface, so they work on ICDs
+  // without surface support and never touch GLFW
+  if (app->mode == APP_MODE_WINDOWED) {
+    da_append(required_extensions, VK_KHR_SURFACE_EXTENSION_NAME);
+
+    uint32_t glfw_required_extension_count = 0;
+    const char **glfw_extensions =
+        glfwGetRequiredInstanceExtensions(&glfw_required_extension_count);
 
-  for (uint32_t i = 0; i < glfw_required_extension_count; i++) {
-    da_append(required_extensions, glfw_extensions[i]);
+    for (uint32_t i = 0; i < glfw_required_extension_count; i++) {
+      da_append(required_extensions, glfw_extensions[i]);
+    }
   }
 
   da_append(required_extensions, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
   da_append(required_extensions,
             VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
-  da_append(required_extensions, VK_KHR_SURFACE_EXTENSION_NAME);
-  da_append(required_extensions, VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
   if (enable_validation_layers) {
     da_append(required_extensions, VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -237,6 +1169,7 @@ extension_properties_da_t get_available_instance_extensions() {
 typedef struct {
   optional_uint32_t graphics_family;
   optional_uint32_t present_family;
+  optional_uint32_t compute_family;
 } queue_family_indices_t;
 
 typedef struct {
@@ -245,10 +1178,39 @@ typedef struct {
   uint32_t capacity;
 } queue_family_properties_da_t;
 
-bool indices_complete(queue_family_indices_t indices) {
+bool indices_complete(app_t *app, queue_family_indices_t indices) {
+  if (app->mode == APP_MODE_COMPUTE) {
+    return indices.compute_family.present;
+  }
+
+  if (app->mode == APP_MODE_HEADLESS) {
+    return indices.graphics_family.present;
+  }
+
   return indices.graphics_family.present && indices.present_family.present;
 }
 
+// Every window is presented in one call on one queue, so its family has to
+// support all of their surfaces
+bool family_presents_to_windows(app_t *app, VkPhysicalDevice device,
+                                uint32_t family) {
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    VkSurfaceKHR surface = app->windows.items[i].surface;
+    if (surface == VK_NULL_HANDLE) {
+      return false;
+    }
+
+    VkBool32 present_support = false;
+    vkGetPhysicalDeviceSurfaceSupportKHR(device, family, surface,
+                                         &present_support);
+    if (!present_support) {
+      return false;
+    }
+  }
+
+  return app->windows.count > 0;
+}
+
 queue_family_indices_t find_queue_families(app_t *app,
                                            VkPhysicalDevice device) {
   queue_family_indices_t indices = {0};
@@ -265,14 +1227,23 @@ queue_family_indices_t find_queue_families(app_t *app,
           (optional_uint32_t){.present = true, .value = i};
     }
 
-    VkBool32 present_support = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, app->surface,
-                                         &present_support);
-    if (present_support) {
+    // Prefer a compute family without graphics, which on most discrete GPUs
+    // is the async compute queue
+    if (queue_families.items[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+      bool dedicated =
+          !(queue_families.items[i].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+      if (!indices.compute_family.present || dedicated) {
+        indices.compute_family =
+            (optional_uint32_t){.present = true, .value = i};
+      }
+    }
+
+    if (family_presents_to_windows(app, device, i)) {
       indices.present_family = (optional_uint32_t){.present = true, .value = i};
     }
 
-    if (indices_complete(indices)) {
+    // Compute mode scans every family looking for a dedicated one
+    if (app->mode != APP_MODE_COMPUTE && indices_complete(app, indices)) {
       break;
     }
   }
@@ -302,28 +1273,29 @@ typedef struct {
   present_modes_da_t present_modes;
 } swapchain_support_details_t;
 
-swapchain_support_details_t query_swap_chain_support(app_t *app,
-                                                     VkPhysicalDevice device) {
+swapchain_support_details_t query_swap_chain_support(VkPhysicalDevice device,
+                                                     VkSurfaceKHR surface) {
   swapchain_support_details_t details = {0};
 
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, app->surface,
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
                                             &details.capabilities);
 
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, app->surface,
-                                       &details.formats.count, NULL);
+  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &details.formats.count,
+                                       NULL);
 
   if (details.formats.count != 0) {
     da_capacity(details.formats, details.formats.count);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(
-        device, app->surface, &details.formats.count, details.formats.items);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface,
+                                         &details.formats.count,
+                                         details.formats.items);
   }
 
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, app->surface,
+  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
                                             &details.present_modes.count, NULL);
 
   if (details.present_modes.count != 0) {
     da_capacity(details.present_modes, details.present_modes.count);
-    vkGetPhysicalDeviceSurfacePresentModesKHR(device, app->surface,
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
                                               &details.present_modes.count,
                                               details.present_modes.items);
   }
@@ -354,14 +1326,14 @@ VkPresentModeKHR choose_swap_present_mode(present_modes_da_t present_modes) {
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkExtent2D choose_swap_extent(app_t *app,
+VkExtent2D choose_swap_extent(window_t *window,
                               const VkSurfaceCapabilitiesKHR capabilities) {
   if (capabilities.currentExtent.width != UINT_MAX) {
     return capabilities.currentExtent;
   }
 
   int width, height;
-  glfwGetFramebufferSize(app->window, &width, &height);
+  glfwGetFramebufferSize(window->window, &width, &height);
 
   VkExtent2D actual_extent = {(uint32_t)width, (uint32_t)height};
 
@@ -375,15 +1347,23 @@ VkExtent2D choose_swap_extent(app_t *app,
   return actual_extent;
 }
 
-void create_swapchain(app_t *app) {
+void create_swapchain(app_t *app, window_t *window) {
   swapchain_support_details_t swap_chain_support =
-      query_swap_chain_support(app, app->physical_device);
+      query_swap_chain_support(app->physical_device, window->surface);
 
   VkSurfaceFormatKHR surface_format =
       choose_swap_surface_format(swap_chain_support.formats);
   VkPresentModeKHR present_mode =
       choose_swap_present_mode(swap_chain_support.present_modes);
-  VkExtent2D extent = choose_swap_extent(app, swap_chain_support.capabilities);
+  VkExtent2D extent =
+      choose_swap_extent(window, swap_chain_support.capabilities);
+
+  // The first window decides the format the render pass is built for
+  if (window == &app->windows.items[0]) {
+    app->swapchain_image_format = surface_format.format;
+  } else if (surface_format.format != app->swapchain_image_format) {
+    error("windows with different surface formats aren't supported!");
+  }
 
   uint32_t image_count = swap_chain_support.capabilities.minImageCount + 1;
 
@@ -394,7 +1374,7 @@ void create_swapchain(app_t *app) {
 
   VkSwapchainCreateInfoKHR create_info = {0};
   create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  create_info.surface = app->surface;
+  create_info.surface = window->surface;
   create_info.minImageCount = image_count;
   create_info.imageFormat = surface_format.format;
   create_info.imageColorSpace = surface_format.colorSpace;
@@ -402,6 +1382,14 @@ void create_swapchain(app_t *app) {
   create_info.imageArrayLayers = 1;
   create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+  // Lets frames be captured, only added where supported
+  window->swapchain_transfer_src =
+      swap_chain_support.capabilities.supportedUsageFlags &
+      VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (window->swapchain_transfer_src) {
+    create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+
   queue_family_indices_t indices =
       find_queue_families(app, app->physical_device);
 
@@ -424,33 +1412,32 @@ void create_swapchain(app_t *app) {
   create_info.clipped = VK_TRUE;
   create_info.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR(app->device, &create_info, NULL, &app->swapchain) !=
-      VK_SUCCESS) {
+  if (vkCreateSwapchainKHR(app->device, &create_info, NULL,
+                           &window->swapchain) != VK_SUCCESS) {
     error("failed to create swap chain!");
   }
 
-  vkGetSwapchainImagesKHR(app->device, app->swapchain, &image_count, NULL);
-  da_capacity(app->swapchain_images, image_count); // NOLINT
-  app->swapchain_images.count = image_count;
-  vkGetSwapchainImagesKHR(app->device, app->swapchain, &image_count,
-                          app->swapchain_images.items);
+  vkGetSwapchainImagesKHR(app->device, window->swapchain, &image_count, NULL);
+  da_capacity(window->swapchain_images, image_count); // NOLINT
+  window->swapchain_images.count = image_count;
+  vkGetSwapchainImagesKHR(app->device, window->swapchain, &image_count,
+                          window->swapchain_images.items);
 
-  app->swapchain_extent = extent;
-  app->swapchain_image_format = surface_format.format;
+  window->swapchain_extent = extent;
 }
 
 /*************
  * Image views
  *************/
 
-void create_image_views(app_t *app) {
-  app->swapchain_image_views = (swapchain_image_views_da_t){0};
-  da_capacity(app->swapchain_image_views, app->swapchain_images.count);
+void create_image_views(app_t *app, window_t *window) {
+  window->swapchain_image_views = (swapchain_image_views_da_t){0};
+  da_capacity(window->swapchain_image_views, window->swapchain_images.count);
 
-  for (size_t i = 0; i < app->swapchain_images.count; i++) {
+  for (size_t i = 0; i < window->swapchain_images.count; i++) {
     VkImageViewCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    create_info.image = app->swapchain_images.items[i];
+    create_info.image = window->swapchain_images.items[i];
     create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
     create_info.format = app->swapchain_image_format;
     create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -464,7 +1451,8 @@ void create_image_views(app_t *app) {
     create_info.subresourceRange.layerCount = 1;
 
     if (vkCreateImageView(app->device, &create_info, NULL,
-                          &app->swapchain_image_views.items[i]) != VK_SUCCESS) {
+                          &window->swapchain_image_views.items[i]) !=
+        VK_SUCCESS) {
       error("failed to create image views!");
     }
   }
@@ -514,6 +1502,51 @@ bool check_device_extension_support(VkPhysicalDevice device) {
   return required_extensions.count == 0;
 }
 
+bool device_supports_extension(VkPhysicalDevice device, const char *name) {
+  extension_properties_da_t available_extensions = {0};
+  vkEnumerateDeviceExtensionProperties(device, NULL,
+                                       &available_extensions.count, NULL);
+  da_capacity(available_extensions, available_extensions.count);
+  vkEnumerateDeviceExtensionProperties(
+      device, NULL, &available_extensions.count, available_extensions.items);
+
+  bool found = false;
+  for (uint32_t i = 0; i < available_extensions.count; i++) {
+    if (strcmp(available_extensions.items[i].extensionName, name) == 0) {
+      found = true;
+      break;
+    }
+  }
+
+  da_free(available_extensions);
+  return found;
+}
+
+bool timeline_semaphores_supported(app_t *app, VkPhysicalDevice device) {
+  if (!device_supports_extension(device,
+                                 VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+    return false;
+  }
+
+  PFN_vkGetPhysicalDeviceFeatures2KHR get_features2 =
+      (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+          app->instance, "vkGetPhysicalDeviceFeatures2KHR");
+  if (get_features2 == NULL) {
+    return false;
+  }
+
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {0};
+  timeline_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+  VkPhysicalDeviceFeatures2KHR features = {0};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+  features.pNext = &timeline_features;
+  get_features2(device, &features);
+
+  return timeline_features.timelineSemaphore;
+}
+
 int rate_device_suitability(app_t *app, VkPhysicalDevice device) {
   VkPhysicalDeviceProperties device_properties;
   VkPhysicalDeviceFeatures device_features;
@@ -535,24 +1568,40 @@ int rate_device_suitability(app_t *app, VkPhysicalDevice device) {
 
   queue_family_indices_t indices = find_queue_families(app, device);
 
-  if (!indices_complete(indices) || !check_device_extension_support(device)) {
+  if (!indices_complete(app, indices)) {
     return 0;
   }
 
-  swapchain_support_details_t swap_chain_support =
-      query_swap_chain_support(app, device);
+  if (app->mode == APP_MODE_COMPUTE) {
+    // Batches are chained with timeline semaphores
+    return timeline_semaphores_supported(app, device) ? score : 0;
+  }
+
+  if (app->mode == APP_MODE_HEADLESS) {
+    return score;
+  }
 
-  if (swap_chain_support.formats.count == 0 ||
-      swap_chain_support.present_modes.count == 0) {
+  if (!check_device_extension_support(device)) {
     return 0;
   }
 
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    swapchain_support_details_t swap_chain_support =
+        query_swap_chain_support(device, app->windows.items[i].surface);
+
+    if (swap_chain_support.formats.count == 0 ||
+        swap_chain_support.present_modes.count == 0) {
+      return 0;
+    }
+  }
+
   return score;
 }
 
+// Best candidate first
 int sort_scored_devices(physical_device_scored_t left,
                         physical_device_scored_t right) {
-  return left.score - right.score;
+  return right.score - left.score;
 }
 
 void pick_physical_device(app_t *app) {
@@ -603,13 +1652,19 @@ void create_logical_device(app_t *app) {
   queue_family_indices_t indices =
       find_queue_families(app, app->physical_device);
 
-  assert(indices_complete(indices));
+  assert(indices_complete(app, indices));
 
   device_queue_create_infos_da_t queue_create_infos = {0};
   uint32_da_t unique_queue_families = {0};
-  da_append(unique_queue_families, indices.graphics_family.value);
 
-  if (indices.graphics_family.value != indices.present_family.value) {
+  if (app->mode == APP_MODE_COMPUTE) {
+    da_append(unique_queue_families, indices.compute_family.value);
+  } else {
+    da_append(unique_queue_families, indices.graphics_family.value);
+  }
+
+  if (indices.present_family.present &&
+      indices.graphics_family.value != indices.present_family.value) {
     da_append(unique_queue_families, indices.present_family.value);
   }
 
@@ -628,15 +1683,40 @@ void create_logical_device(app_t *app) {
   VkPhysicalDeviceFeatures device_features = {0};
 
   const_strings_da_t enabled_extensions = {0};
-  da_append(enabled_extensions, "VK_KHR_portability_subset");
 
-  for (uint32_t i = 0; i < sizeof(device_extensions) / sizeof(const char *);
-       i++) {
-    da_append(enabled_extensions, device_extensions[i]);
+  // Only exposed (and then required) by portability drivers like MoltenVK
+  if (device_supports_extension(app->physical_device,
+                                "VK_KHR_portability_subset")) {
+    da_append(enabled_extensions, "VK_KHR_portability_subset");
+  }
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    for (uint32_t i = 0; i < sizeof(device_extensions) / sizeof(const char *);
+         i++) {
+      da_append(enabled_extensions, device_extensions[i]);
+    }
+  }
+
+  // Optional, texture streaming falls back to heap sizes without it
+  app->streaming.memory_budget_supported = device_supports_extension(
+      app->physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if (app->streaming.memory_budget_supported) {
+    da_append(enabled_extensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {0};
+  timeline_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+  timeline_features.timelineSemaphore = VK_TRUE;
+
+  if (app->mode == APP_MODE_COMPUTE) {
+    da_append(enabled_extensions, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
   }
 
   VkDeviceCreateInfo create_info = {0};
   create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  create_info.pNext =
+      app->mode == APP_MODE_COMPUTE ? &timeline_features : NULL;
   create_info.pQueueCreateInfos = queue_create_infos.items;
   create_info.queueCreateInfoCount = queue_create_infos.count;
   create_info.pEnabledFeatures = &device_features;
@@ -657,10 +1737,18 @@ void create_logical_device(app_t *app) {
     error("failed to create logical device!\n");
   }
 
+  if (app->mode == APP_MODE_COMPUTE) {
+    vkGetDeviceQueue(app->device, indices.compute_family.value, 0,
+                     &app->compute_queue);
+    return;
+  }
+
   vkGetDeviceQueue(app->device, indices.graphics_family.value, 0,
                    &app->graphics_queue);
-  vkGetDeviceQueue(app->device, indices.present_family.value, 0,
-                   &app->present_queue);
+  if (indices.present_family.present) {
+    vkGetDeviceQueue(app->device, indices.present_family.value, 0,
+                     &app->present_queue);
+  }
 }
 
 /**********
@@ -676,7 +1764,8 @@ void create_instance(app_t *app) {
   app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
   app_info.apiVersion = VK_API_VERSION_1_0;
 
-  const_strings_da_t required_extensions = get_required_instance_extensions();
+  const_strings_da_t required_extensions =
+      get_required_instance_extensions(app);
   extension_properties_da_t available_extensions =
       get_available_instance_extensions();
 
@@ -706,7 +1795,7 @@ void create_instance(app_t *app) {
         sizeof(validation_layers) / sizeof(const char *);
     create_info.ppEnabledLayerNames = validation_layers;
 
-    populate_debug_messenger_create_info(&debug_create_info);
+    populate_debug_messenger_create_info(app, &debug_create_info);
     create_info.pNext = &debug_create_info;
   } else {
     create_info.enabledLayerCount = 0;
@@ -725,73 +1814,4861 @@ void create_instance(app_t *app) {
  * Surface
  ************/
 
-void create_surface(app_t *app) {
-  uint32_t result =
-      glfwCreateWindowSurface(app->instance, app->window, NULL, &app->surface);
+void create_surface(app_t *app, window_t *window) {
+  uint32_t result = glfwCreateWindowSurface(app->instance, window->window, NULL,
+                                            &window->surface);
   if (result != VK_SUCCESS) {
     error("failed to create window surface with status %d\n", result);
   }
 }
 
-/************
- * Main hooks
- ************/
+/****************
+ * Pipeline cache
+ ****************/
 
-void init_window(app_t *app) {
-  glfwInit();
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+#define PIPELINE_CACHE_INITIAL_CAPACITY 64
 
-  // Don't create an OpenGL context
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+void pipeline_key_init(pipeline_key_t *key) {
+  memset(key, 0, sizeof(*key));
+  key->topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  key->cull_mode = VK_CULL_MODE_BACK_BIT;
+  key->depth_compare_op = VK_COMPARE_OP_LESS;
+}
 
-  app->window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", NULL, NULL);
+VkResult compile_pipeline(VkDevice device, VkPipelineCache vk_cache,
+                          const pipeline_key_t *key, VkPipeline *pipeline) {
+  VkPipelineShaderStageCreateInfo stages[2] = {0};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = key->vertex_shader;
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = key->fragment_shader;
+  stages[1].pName = "main";
+
+  VkPipelineVertexInputStateCreateInfo vertex_input = {0};
+  vertex_input.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input.vertexBindingDescriptionCount = key->binding_count;
+  vertex_input.pVertexBindingDescriptions = key->bindings;
+  vertex_input.vertexAttributeDescriptionCount = key->attribute_count;
+  vertex_input.pVertexAttributeDescriptions = key->attributes;
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {0};
+  input_assembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = key->topology;
+  input_assembly.primitiveRestartEnable = VK_FALSE;
+
+  // Viewport and scissor are dynamic so swapchain resizes don't invalidate
+  // cached pipelines
+  VkPipelineViewportStateCreateInfo viewport_state = {0};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.scissorCount = 1;
+
+  VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                     VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamic_state = {0};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.dynamicStateCount =
+      sizeof(dynamic_states) / sizeof(VkDynamicState);
+  dynamic_state.pDynamicStates = dynamic_states;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {0};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = key->cull_mode;
+  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {0};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {0};
+  depth_stencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = key->depth_test_enable;
+  depth_stencil.depthWriteEnable = key->depth_write_enable;
+  depth_stencil.depthCompareOp = key->depth_compare_op;
+
+  VkPipelineColorBlendAttachmentState color_blend_attachment = {0};
+  color_blend_attachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  color_blend_attachment.blendEnable = key->blend_enable;
+  color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  color_blend_attachment.dstColorBlendFactor =
+      VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+  color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  VkPipelineColorBlendStateCreateInfo color_blending = {0};
+  color_blending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blending.attachmentCount = 1;
+  color_blending.pAttachments = &color_blend_attachment;
+
+  VkGraphicsPipelineCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  create_info.stageCount = 2;
+  create_info.pStages = stages;
+  create_info.pVertexInputState = &vertex_input;
+  create_info.pInputAssemblyState = &input_assembly;
+  create_info.pViewportState = &viewport_state;
+  create_info.pRasterizationState = &rasterizer;
+  create_info.pMultisampleState = &multisampling;
+  create_info.pDepthStencilState =
+      key->depth_format != VK_FORMAT_UNDEFINED ? &depth_stencil : NULL;
+  create_info.pColorBlendState = &color_blending;
+  create_info.pDynamicState = &dynamic_state;
+  create_info.layout = key->layout;
+  create_info.renderPass = key->render_pass;
+  create_info.subpass = 0;
+
+  return vkCreateGraphicsPipelines(device, vk_cache, 1, &create_info, NULL,
+                                   pipeline);
 }
 
-void init_vulkan(app_t *app) {
-  create_instance(app);
-  setup_debug_messenger(app);
-  create_surface(app);
-  pick_physical_device(app);
-  create_logical_device(app);
-  create_swapchain(app);
-  create_image_views(app);
+void *pipeline_cache_worker(void *arg) {
+  pipeline_cache_t *cache = arg;
+
+  pthread_mutex_lock(&cache->mutex);
+
+  while (true) {
+    while (cache->running && cache->queued.count == 0) {
+      pthread_cond_wait(&cache->cond, &cache->mutex);
+    }
+
+    if (!cache->running) {
+      break;
+    }
+
+    // Take the whole batch so the frame thread can keep queueing while we
+    // compile
+    pipeline_jobs_da_t batch = cache->queued;
+    cache->queued = (pipeline_jobs_da_t){0};
+    pthread_mutex_unlock(&cache->mutex);
+
+    for (size_t i = 0; i < batch.count; i++) {
+      pipeline_job_t *job = &batch.items[i];
+      job->result = compile_pipeline(cache->device, cache->vk_cache, &job->key,
+                                     &job->pipeline);
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t i = 0; i < batch.count; i++) {
+      da_append(cache->completed, batch.items[i]);
+    }
+    cache->in_flight -= batch.count;
+    pthread_cond_broadcast(&cache->cond);
+
+    da_free(batch);
+  }
+
+  pthread_mutex_unlock(&cache->mutex);
+  return NULL;
 }
 
-void main_loop(app_t *app) {
-  while (!glfwWindowShouldClose(app->window)) {
-    glfwPollEvents();
+pipeline_entry_t *pipeline_cache_find_slot(pipeline_entry_t *entries,
+                                           uint32_t capacity,
+                                           const pipeline_key_t *key,
+                                           uint64_t hash) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    pipeline_entry_t *entry = &entries[i];
+
+    if (entry->state == PIPELINE_ENTRY_EMPTY) {
+      return entry;
+    }
+
+    if (entry->hash == hash &&
+        memcmp(&entry->key, key, sizeof(pipeline_key_t)) == 0) {
+      return entry;
+    }
   }
 }
 
-void cleanup(app_t *app) {
-  for (uint32_t i = 0; i < app->swapchain_image_views.count; i++) {
-    vkDestroyImageView(app->device, app->swapchain_image_views.items[i], NULL);
+void pipeline_cache_grow(pipeline_cache_t *cache) {
+  uint32_t capacity = cache->entries_capacity * 2;
+  pipeline_entry_t *entries = calloc(capacity, sizeof(pipeline_entry_t));
+
+  for (uint32_t i = 0; i < cache->entries_capacity; i++) {
+    pipeline_entry_t *entry = &cache->entries[i];
+    if (entry->state != PIPELINE_ENTRY_EMPTY) {
+      *pipeline_cache_find_slot(entries, capacity, &entry->key, entry->hash) =
+          *entry;
+    }
   }
 
-  vkDestroySwapchainKHR(app->device, app->swapchain, NULL);
-  vkDestroyDevice(app->device, NULL);
+  free(cache->entries);
+  cache->entries = entries;
+  cache->entries_capacity = capacity;
+}
 
-  if (enable_validation_layers) {
-    destroy_debug_utils_messenger_ext(app->instance, app->debug_messenger,
-                                      NULL);
+pipeline_entry_t *pipeline_cache_lookup(pipeline_cache_t *cache,
+                                        const pipeline_key_t *key,
+                                        uint64_t hash) {
+  return pipeline_cache_find_slot(cache->entries, cache->entries_capacity, key,
+                                  hash);
+}
+
+// Queue a pipeline for background compilation without waiting for it. Use this
+// at load time for every variant a scene is going to need.
+void pipeline_cache_request(pipeline_cache_t *cache,
+                            const pipeline_key_t *key) {
+  uint64_t hash = hash_bytes(key, sizeof(pipeline_key_t));
+  pipeline_entry_t *entry = pipeline_cache_lookup(cache, key, hash);
+
+  if (entry->state != PIPELINE_ENTRY_EMPTY) {
+    return;
   }
 
-  vkDestroySurfaceKHR(app->instance, app->surface, NULL);
-  vkDestroyInstance(app->instance, NULL);
-  glfwDestroyWindow(app->window);
-  glfwTerminate();
+  if ((cache->entries_count + 1) * 4 > cache->entries_capacity * 3) {
+    pipeline_cache_grow(cache);
+    entry = pipeline_cache_lookup(cache, key, hash);
+  }
+
+  entry->key = *key;
+  entry->hash = hash;
+  entry->state = PIPELINE_ENTRY_PENDING;
+  entry->pipeline = VK_NULL_HANDLE;
+  cache->entries_count++;
+
+  pipeline_job_t job = {.key = *key, .hash = hash};
+
+  pthread_mutex_lock(&cache->mutex);
+  da_append(cache->queued, job);
+  cache->in_flight++;
+  pthread_cond_broadcast(&cache->cond);
+  pthread_mutex_unlock(&cache->mutex);
 }
 
-void run(void) {
-  app_t app = {.physical_device = VK_NULL_HANDLE};
+// Returns the compiled pipeline for key, or fallback while it is still being
+// compiled (or failed to compile). Never compiles on the calling thread. Pass
+// VK_NULL_HANDLE as fallback to have the caller skip the draw.
+VkPipeline pipeline_cache_get(pipeline_cache_t *cache,
+                              const pipeline_key_t *key, VkPipeline fallback) {
+  uint64_t hash = hash_bytes(key, sizeof(pipeline_key_t));
+  pipeline_entry_t *entry = pipeline_cache_lookup(cache, key, hash);
+
+  if (entry->state == PIPELINE_ENTRY_READY) {
+    cache->hits++;
+    return entry->pipeline;
+  }
 
-  init_window(&app);
-  init_vulkan(&app);
-  main_loop(&app);
-  cleanup(&app);
+  cache->misses++;
+
+  if (entry->state == PIPELINE_ENTRY_EMPTY) {
+    pipeline_cache_request(cache, key);
+  }
+
+  return fallback;
+}
+
+// Move finished compiles into the table. Call once per frame.
+void pipeline_cache_poll(pipeline_cache_t *cache) {
+  pthread_mutex_lock(&cache->mutex);
+  pipeline_jobs_da_t completed = cache->completed;
+  cache->completed = (pipeline_jobs_da_t){0};
+  pthread_mutex_unlock(&cache->mutex);
+
+  for (size_t i = 0; i < completed.count; i++) {
+    pipeline_job_t *job = &completed.items[i];
+    pipeline_entry_t *entry = pipeline_cache_lookup(cache, &job->key, job->hash);
+    assert(entry->state == PIPELINE_ENTRY_PENDING);
+
+    if (job->result == VK_SUCCESS) {
+      entry->state = PIPELINE_ENTRY_READY;
+      entry->pipeline = job->pipeline;
+      cache->compiled++;
+    } else {
+      fprintf(stderr, "failed to compile pipeline %016llx with status %d\n",
+              (unsigned long long)job->hash, job->result);
+      entry->state = PIPELINE_ENTRY_FAILED;
+      cache->failed++;
+    }
+  }
+
+  da_free(completed);
+}
+
+// Block until every requested pipeline has been compiled. Meant for loading
+// screens, never for the frame loop.
+void pipeline_cache_wait_idle(pipeline_cache_t *cache) {
+  pthread_mutex_lock(&cache->mutex);
+  while (cache->in_flight > 0) {
+    pthread_cond_wait(&cache->cond, &cache->mutex);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  pipeline_cache_poll(cache);
+}
+
+void create_pipeline_cache(app_t *app) {
+  pipeline_cache_t *cache = &app->pipeline_cache;
+  *cache = (pipeline_cache_t){0};
+  cache->device = app->device;
+
+  // Seed the driver cache from the previous run so warm starts skip most of
+  // the shader compiler
+  void *initial_data = NULL;
+  size_t initial_data_size = 0;
+  FILE *file = fopen(PIPELINE_CACHE_PATH, "rb");
+  if (file != NULL) {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size > 0) {
+      initial_data = malloc(size);
+      initial_data_size = fread(initial_data, 1, size, file);
+    }
+    fclose(file);
+  }
+
+  VkPipelineCacheCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  create_info.initialDataSize = initial_data_size;
+  create_info.pInitialData = initial_data;
+
+  if (vkCreatePipelineCache(app->device, &create_info, NULL,
+                            &cache->vk_cache) != VK_SUCCESS) {
+    error("failed to create pipeline cache!");
+  }
+
+  free(initial_data);
+
+  cache->entries_capacity = PIPELINE_CACHE_INITIAL_CAPACITY;
+  cache->entries = calloc(cache->entries_capacity, sizeof(pipeline_entry_t));
+
+  pthread_mutex_init(&cache->mutex, NULL);
+  pthread_cond_init(&cache->cond, NULL);
+  cache->running = true;
+
+  if (pthread_create(&cache->worker, NULL, pipeline_cache_worker, cache) != 0) {
+    error("failed to start pipeline compile worker!");
+  }
+}
+
+void destroy_pipeline_cache(app_t *app) {
+  pipeline_cache_t *cache = &app->pipeline_cache;
+
+  pthread_mutex_lock(&cache->mutex);
+  cache->running = false;
+  pthread_cond_broadcast(&cache->cond);
+  pthread_mutex_unlock(&cache->mutex);
+  pthread_join(cache->worker, NULL);
+
+  // Jobs the worker finished before stopping still own pipelines
+  pipeline_cache_poll(cache);
+
+  for (uint32_t i = 0; i < cache->entries_capacity; i++) {
+    if (cache->entries[i].state == PIPELINE_ENTRY_READY) {
+      vkDestroyPipeline(app->device, cache->entries[i].pipeline, NULL);
+    }
+  }
+
+  size_t data_size = 0;
+  vkGetPipelineCacheData(app->device, cache->vk_cache, &data_size, NULL);
+  if (data_size > 0) {
+    void *data = malloc(data_size);
+    vkGetPipelineCacheData(app->device, cache->vk_cache, &data_size, data);
+
+    FILE *file = fopen(PIPELINE_CACHE_PATH, "wb");
+    if (file != NULL) {
+      fwrite(data, 1, data_size, file);
+      fclose(file);
+    }
+    free(data);
+  }
+
+  printf("pipeline cache: %llu hits, %llu misses, %llu compiled, %llu "
+         "failed\n",
+         (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+         (unsigned long long)cache->compiled,
+         (unsigned long long)cache->failed);
+
+  vkDestroyPipelineCache(app->device, cache->vk_cache, NULL);
+  da_free(cache->queued);
+  da_free(cache->completed);
+  free(cache->entries);
+  pthread_mutex_destroy(&cache->mutex);
+  pthread_cond_destroy(&cache->cond);
+}
+
+/*************
+ * Descriptors
+ *************/
+
+#define DESCRIPTOR_POOL_INITIAL_SETS 256
+#define DESCRIPTOR_POOL_MAX_SETS 4096
+#define DESCRIPTOR_CACHE_INITIAL_CAPACITY 64
+#define DESCRIPTOR_LAYOUT_CACHE_INITIAL_CAPACITY 16
+
+// Descriptors reserved per set in each new pool, by type
+const VkDescriptorPoolSize descriptor_pool_ratios[] = {
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+    {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+};
+
+// Sized by descriptor_pool_ratios, raised to fit max_sets sets of the given
+// layout bindings where it needs more of a type than the ratios give
+VkDescriptorPool create_descriptor_pool(
+    app_t *app, uint32_t max_sets, const descriptor_bindings_da_t *bindings) {
+  uint32_t ratio_count =
+      sizeof(descriptor_pool_ratios) / sizeof(VkDescriptorPoolSize);
+  VkDescriptorPoolSize pool_sizes[ratio_count + bindings->count];
+  uint32_t size_count = ratio_count;
+
+  for (uint32_t i = 0; i < ratio_count; i++) {
+    pool_sizes[i].type = descriptor_pool_ratios[i].type;
+    pool_sizes[i].descriptorCount =
+        descriptor_pool_ratios[i].descriptorCount * max_sets;
+  }
+
+  for (uint32_t i = 0; i < bindings->count; i++) {
+    VkDescriptorType type = bindings->items[i].descriptorType;
+
+    uint32_t per_set = 0;
+    for (uint32_t j = 0; j < bindings->count; j++) {
+      if (bindings->items[j].descriptorType == type) {
+        per_set += bindings->items[j].descriptorCount;
+      }
+    }
+
+    uint32_t size = 0;
+    while (size < size_count && pool_sizes[size].type != type) {
+      size++;
+    }
+    if (size == size_count) {
+      pool_sizes[size_count++] = (VkDescriptorPoolSize){type, 0};
+    }
+
+    if (pool_sizes[size].descriptorCount < per_set * max_sets) {
+      pool_sizes[size].descriptorCount = per_set * max_sets;
+    }
+  }
+
+  VkDescriptorPoolCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  create_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+  create_info.maxSets = max_sets;
+  create_info.poolSizeCount = size_count;
+  create_info.pPoolSizes = pool_sizes;
+
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(app->device, &create_info, NULL, &pool) !=
+      VK_SUCCESS) {
+    error("failed to create descriptor pool!");
+  }
+
+  app->descriptors.pools_created++;
+  return pool;
+}
+
+VkDescriptorPool
+grow_descriptor_pools(app_t *app, const descriptor_bindings_da_t *bindings) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+
+  VkDescriptorPool pool =
+      create_descriptor_pool(app, allocator->sets_per_pool, bindings);
+  da_append(allocator->pools, pool);
+
+  // Each new pool is bigger than the last, so a heavy scene settles on a
+  // handful of pools instead of dozens
+  allocator->sets_per_pool = allocator->sets_per_pool * 3 / 2;
+  if (allocator->sets_per_pool > DESCRIPTOR_POOL_MAX_SETS) {
+    allocator->sets_per_pool = DESCRIPTOR_POOL_MAX_SETS;
+  }
+
+  return pool;
+}
+
+// Only needed when a pool is added, so a scan is fine
+const descriptor_bindings_da_t *
+descriptor_layout_bindings(descriptor_allocator_t *allocator,
+                           VkDescriptorSetLayout layout) {
+  for (uint32_t i = 0; i < allocator->layouts_capacity; i++) {
+    if (allocator->layouts[i].layout == layout) {
+      return &allocator->layouts[i].bindings;
+    }
+  }
+
+  error("descriptor set layout wasn't created by get_descriptor_set_layout!");
+}
+
+// The pool the set came from goes to pool_out, it's needed to free the set
+VkDescriptorSet allocate_descriptor_set(app_t *app,
+                                        VkDescriptorSetLayout layout,
+                                        VkDescriptorPool *pool_out) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+  descriptor_pools_da_t *pools = &allocator->pools;
+  if (pools->count == 0) {
+    grow_descriptor_pools(app, descriptor_layout_bindings(allocator, layout));
+  }
+
+  VkDescriptorSetAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = pools->items[pools->count - 1];
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &layout;
+
+  VkDescriptorSet set;
+  VkResult result = vkAllocateDescriptorSets(app->device, &alloc_info, &set);
+
+  if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
+      result == VK_ERROR_FRAGMENTED_POOL) {
+    // Sized for this layout, so the retry can only fail on device limits
+    const descriptor_bindings_da_t *bindings =
+        descriptor_layout_bindings(allocator, layout);
+    alloc_info.descriptorPool = grow_descriptor_pools(app, bindings);
+    result = vkAllocateDescriptorSets(app->device, &alloc_info, &set);
+  }
+
+  if (result != VK_SUCCESS) {
+    error("failed to allocate descriptor set with status %d", result);
+  }
+
+  *pool_out = alloc_info.descriptorPool;
+  return set;
+}
+
+void write_descriptor_set(app_t *app, VkDescriptorSet set,
+                          const descriptor_write_t *writes,
+                          uint32_t write_count) {
+  VkWriteDescriptorSet vk_writes[write_count];
+
+  for (uint32_t i = 0; i < write_count; i++) {
+    const descriptor_write_t *write = &writes[i];
+    bool is_buffer = write->type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
+                     write->type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+    vk_writes[i] = (VkWriteDescriptorSet){0};
+    vk_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    vk_writes[i].dstSet = set;
+    vk_writes[i].dstBinding = write->binding;
+    vk_writes[i].dstArrayElement = 0;
+    vk_writes[i].descriptorCount = 1;
+    vk_writes[i].descriptorType = write->type;
+    vk_writes[i].pImageInfo = is_buffer ? NULL : &write->image;
+    vk_writes[i].pBufferInfo = is_buffer ? &write->buffer : NULL;
+  }
+
+  vkUpdateDescriptorSets(app->device, write_count, vk_writes, 0, NULL);
+}
+
+int compare_layout_bindings(const void *left, const void *right) {
+  uint32_t a = ((const VkDescriptorSetLayoutBinding *)left)->binding;
+  uint32_t b = ((const VkDescriptorSetLayoutBinding *)right)->binding;
+  return (a > b) - (a < b);
+}
+
+descriptor_layout_entry_t *
+descriptor_layout_find_slot(descriptor_layout_entry_t *entries,
+                            uint32_t capacity,
+                            const descriptor_bindings_da_t *bindings,
+                            uint64_t hash) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    descriptor_layout_entry_t *entry = &entries[i];
+
+    if (entry->layout == VK_NULL_HANDLE) {
+      return entry;
+    }
+
+    if (entry->hash == hash && entry->bindings.count == bindings->count &&
+        memcmp(entry->bindings.items, bindings->items,
+               bindings->count * sizeof(VkDescriptorSetLayoutBinding)) == 0) {
+      return entry;
+    }
+  }
+}
+
+void descriptor_layout_cache_grow(descriptor_allocator_t *allocator) {
+  uint32_t capacity = allocator->layouts_capacity * 2;
+  descriptor_layout_entry_t *entries =
+      calloc(capacity, sizeof(descriptor_layout_entry_t));
+
+  for (uint32_t i = 0; i < allocator->layouts_capacity; i++) {
+    descriptor_layout_entry_t *entry = &allocator->layouts[i];
+    if (entry->layout != VK_NULL_HANDLE) {
+      *descriptor_layout_find_slot(entries, capacity, &entry->bindings,
+                                   entry->hash) = *entry;
+    }
+  }
+
+  free(allocator->layouts);
+  allocator->layouts = entries;
+  allocator->layouts_capacity = capacity;
+}
+
+// Layouts are deduplicated by content, so callers can ask for the same layout
+// every frame without creating a new object.
+VkDescriptorSetLayout get_descriptor_set_layout(
+    app_t *app, const VkDescriptorSetLayoutBinding *bindings,
+    uint32_t binding_count) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+
+  descriptor_bindings_da_t sorted = {0};
+  for (uint32_t i = 0; i < binding_count; i++) {
+    da_append(sorted, bindings[i]);
+  }
+  if (sorted.count > 0) {
+    qsort(sorted.items, sorted.count, sizeof(VkDescriptorSetLayoutBinding),
+          compare_layout_bindings);
+  }
+
+  uint64_t hash = HASH_SEED;
+  for (uint32_t i = 0; i < sorted.count; i++) {
+    VkDescriptorSetLayoutBinding binding = sorted.items[i];
+    binding.pImmutableSamplers = NULL;
+    hash = hash_combine(hash, &binding, sizeof(binding));
+
+    if (sorted.items[i].pImmutableSamplers != NULL) {
+      hash = hash_combine(hash, sorted.items[i].pImmutableSamplers,
+                          sorted.items[i].descriptorCount * sizeof(VkSampler));
+    }
+  }
+
+  descriptor_layout_entry_t *entry = descriptor_layout_find_slot(
+      allocator->layouts, allocator->layouts_capacity, &sorted, hash);
+
+  if (entry->layout != VK_NULL_HANDLE) {
+    da_free(sorted);
+    return entry->layout;
+  }
+
+  if ((allocator->layouts_count + 1) * 4 > allocator->layouts_capacity * 3) {
+    descriptor_layout_cache_grow(allocator);
+    entry = descriptor_layout_find_slot(
+        allocator->layouts, allocator->layouts_capacity, &sorted, hash);
+  }
+
+  VkDescriptorSetLayoutCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  create_info.bindingCount = sorted.count;
+  create_info.pBindings = sorted.items;
+
+  entry->hash = hash;
+  entry->bindings = sorted;
+  if (vkCreateDescriptorSetLayout(app->device, &create_info, NULL,
+                                  &entry->layout) != VK_SUCCESS) {
+    error("failed to create descriptor set layout!");
+  }
+  allocator->layouts_count++;
+
+  return entry->layout;
+}
+
+// Field by field, so padding in descriptor_write_t never matters
+uint64_t hash_descriptor_writes(VkDescriptorSetLayout layout,
+                                const descriptor_write_t *writes,
+                                uint32_t write_count) {
+  uint64_t hash = hash_bytes(&layout, sizeof(layout));
+
+  for (uint32_t i = 0; i < write_count; i++) {
+    const descriptor_write_t *write = &writes[i];
+    hash = hash_combine(hash, &write->binding, sizeof(write->binding));
+    hash = hash_combine(hash, &write->type, sizeof(write->type));
+    hash = hash_combine(hash, &write->image.sampler,
+                        sizeof(write->image.sampler));
+    hash = hash_combine(hash, &write->image.imageView,
+                        sizeof(write->image.imageView));
+    hash = hash_combine(hash, &write->image.imageLayout,
+                        sizeof(write->image.imageLayout));
+    hash = hash_combine(hash, &write->buffer.buffer,
+                        sizeof(write->buffer.buffer));
+    hash = hash_combine(hash, &write->buffer.offset,
+                        sizeof(write->buffer.offset));
+    hash = hash_combine(hash, &write->buffer.range,
+                        sizeof(write->buffer.range));
+  }
+
+  return hash;
+}
+
+bool descriptor_writes_equal(const descriptor_write_t *left,
+                             const descriptor_write_t *right,
+                             uint32_t write_count) {
+  for (uint32_t i = 0; i < write_count; i++) {
+    const descriptor_write_t *a = &left[i];
+    const descriptor_write_t *b = &right[i];
+
+    if (a->binding != b->binding || a->type != b->type ||
+        a->image.sampler != b->image.sampler ||
+        a->image.imageView != b->image.imageView ||
+        a->image.imageLayout != b->image.imageLayout ||
+        a->buffer.buffer != b->buffer.buffer ||
+        a->buffer.offset != b->buffer.offset ||
+        a->buffer.range != b->buffer.range) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+descriptor_immutable_set_t *
+descriptor_cache_find_slot(descriptor_immutable_set_t *entries,
+                           uint32_t capacity, VkDescriptorSetLayout layout,
+                           const descriptor_write_t *writes,
+                           uint32_t write_count, uint64_t hash) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    descriptor_immutable_set_t *entry = &entries[i];
+
+    if (entry->set == VK_NULL_HANDLE) {
+      if (entry->released) {
+        continue;
+      }
+      return entry;
+    }
+
+    if (entry->hash == hash && entry->layout == layout &&
+        entry->write_count == write_count &&
+        descriptor_writes_equal(entry->writes, writes, write_count)) {
+      return entry;
+    }
+  }
+}
+
+// Drops released slots, and only grows when the live sets need the room
+void descriptor_cache_rehash(descriptor_allocator_t *allocator) {
+  uint32_t live = 0;
+  for (uint32_t i = 0; i < allocator->immutable_sets_capacity; i++) {
+    if (allocator->immutable_sets[i].set != VK_NULL_HANDLE) {
+      live++;
+    }
+  }
+
+  uint32_t capacity = allocator->immutable_sets_capacity;
+  while ((live + 1) * 2 > capacity) {
+    capacity *= 2;
+  }
+
+  descriptor_immutable_set_t *entries =
+      calloc(capacity, sizeof(descriptor_immutable_set_t));
+
+  for (uint32_t i = 0; i < allocator->immutable_sets_capacity; i++) {
+    descriptor_immutable_set_t *entry = &allocator->immutable_sets[i];
+    if (entry->set != VK_NULL_HANDLE) {
+      *descriptor_cache_find_slot(entries, capacity, entry->layout,
+                                  entry->writes, entry->write_count,
+                                  entry->hash) = *entry;
+    }
+  }
+
+  free(allocator->immutable_sets);
+  allocator->immutable_sets = entries;
+  allocator->immutable_sets_capacity = capacity;
+  allocator->immutable_sets_count = live;
 }
 
-int main(void) {
-  run();
+// Sets whose contents never change (material textures and the like) are
+// written once and shared by every caller asking for the same contents.
+VkDescriptorSet get_immutable_descriptor_set(app_t *app,
+                                             VkDescriptorSetLayout layout,
+                                             const descriptor_write_t *writes,
+                                             uint32_t write_count) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+
+  if (write_count > DESCRIPTOR_SET_MAX_WRITES) {
+    error("immutable descriptor sets take at most %d writes!",
+          DESCRIPTOR_SET_MAX_WRITES);
+  }
+
+  uint64_t hash = hash_descriptor_writes(layout, writes, write_count);
+  descriptor_immutable_set_t *entry = descriptor_cache_find_slot(
+      allocator->immutable_sets, allocator->immutable_sets_capacity, layout,
+      writes, write_count, hash);
+
+  if (entry->set != VK_NULL_HANDLE) {
+    return entry->set;
+  }
+
+  if ((allocator->immutable_sets_count + 1) * 4 >
+      allocator->immutable_sets_capacity * 3) {
+    descriptor_cache_rehash(allocator);
+    entry = descriptor_cache_find_slot(allocator->immutable_sets,
+                                       allocator->immutable_sets_capacity,
+                                       layout, writes, write_count, hash);
+  }
+
+  entry->hash = hash;
+  entry->layout = layout;
+  entry->write_count = write_count;
+  memcpy(entry->writes, writes, write_count * sizeof(descriptor_write_t));
+  entry->set = allocate_descriptor_set(app, layout, &entry->pool);
+  write_descriptor_set(app, entry->set, writes, write_count);
+  allocator->immutable_sets_count++;
+  allocator->immutable_sets_live++;
+
+  return entry->set;
+}
+
+// Take a set out of the cache once a resource it points at is going away.
+// Every caller that asked for the same contents loses it too. The set is
+// handed back in set_out and pool_out for the caller to free once frames in
+// flight are done with it; both are VK_NULL_HANDLE if it was never cached.
+void evict_immutable_descriptor_set(app_t *app, VkDescriptorSetLayout layout,
+                                    const descriptor_write_t *writes,
+                                    uint32_t write_count,
+                                    VkDescriptorPool *pool_out,
+                                    VkDescriptorSet *set_out) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+
+  uint64_t hash = hash_descriptor_writes(layout, writes, write_count);
+  descriptor_immutable_set_t *entry = descriptor_cache_find_slot(
+      allocator->immutable_sets, allocator->immutable_sets_capacity, layout,
+      writes, write_count, hash);
+
+  *pool_out = entry->pool;
+  *set_out = entry->set;
+
+  if (entry->set != VK_NULL_HANDLE) {
+    *entry = (descriptor_immutable_set_t){.released = true};
+    allocator->immutable_sets_live--;
+  }
+}
+
+uint32_t descriptor_pools_in_use(app_t *app) {
+  return app->descriptors.pools.count;
+}
+
+void create_descriptor_allocator(app_t *app) {
+  app->descriptors = (descriptor_allocator_t){0};
+  app->descriptors.sets_per_pool = DESCRIPTOR_POOL_INITIAL_SETS;
+  app->descriptors.immutable_sets_capacity = DESCRIPTOR_CACHE_INITIAL_CAPACITY;
+  app->descriptors.immutable_sets = calloc(DESCRIPTOR_CACHE_INITIAL_CAPACITY,
+                                           sizeof(descriptor_immutable_set_t));
+  app->descriptors.layouts_capacity = DESCRIPTOR_LAYOUT_CACHE_INITIAL_CAPACITY;
+  app->descriptors.layouts = calloc(DESCRIPTOR_LAYOUT_CACHE_INITIAL_CAPACITY,
+                                    sizeof(descriptor_layout_entry_t));
+}
+
+void destroy_descriptor_allocator(app_t *app) {
+  descriptor_allocator_t *allocator = &app->descriptors;
+
+  printf("descriptors: %u pools created, %u in use, %u sets cached\n",
+         allocator->pools_created, descriptor_pools_in_use(app),
+         allocator->immutable_sets_live);
+
+  for (uint32_t i = 0; i < allocator->pools.count; i++) {
+    vkDestroyDescriptorPool(app->device, allocator->pools.items[i], NULL);
+  }
+  da_free(allocator->pools);
+
+  for (uint32_t i = 0; i < allocator->layouts_capacity; i++) {
+    descriptor_layout_entry_t *entry = &allocator->layouts[i];
+    if (entry->layout != VK_NULL_HANDLE) {
+      vkDestroyDescriptorSetLayout(app->device, entry->layout, NULL);
+      da_free(entry->bindings);
+    }
+  }
+  free(allocator->layouts);
+  free(allocator->immutable_sets);
+}
+
+/********
+ * Memory
+ ********/
+
+optional_uint32_t try_find_memory_type(app_t *app, uint32_t type_filter,
+                                       VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(app->physical_device, &memory_properties);
+
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+    if ((type_filter & (1u << i)) &&
+        (memory_properties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return (optional_uint32_t){.present = true, .value = i};
+    }
+  }
+
+  return (optional_uint32_t){0};
+}
+
+uint32_t find_memory_type(app_t *app, uint32_t type_filter,
+                          VkMemoryPropertyFlags properties) {
+  optional_uint32_t type = try_find_memory_type(app, type_filter, properties);
+
+  if (!type.present) {
+    error("failed to find suitable memory type!");
+  }
+
+  return type.value;
+}
+
+#define MEMORY_TRACKER_INITIAL_CAPACITY 256
+
+memory_allocation_t *memory_tracker_find_slot(memory_allocation_t *slots,
+                                              uint32_t capacity,
+                                              VkDeviceMemory memory) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t i = hash_bytes(&memory, sizeof(memory)) & mask;;
+       i = (i + 1) & mask) {
+    memory_allocation_t *slot = &slots[i];
+
+    if (slot->memory == memory ||
+        (slot->memory == VK_NULL_HANDLE && !slot->freed)) {
+      return slot;
+    }
+  }
+}
+
+// Drops freed slots, and only grows if the live ones need it. Streaming
+// allocates and frees staging memory every frame, which would otherwise keep
+// doubling the table.
+void memory_tracker_rehash(memory_tracker_t *tracker) {
+  uint32_t live = 0;
+  for (uint32_t i = 0; i < tracker->capacity; i++) {
+    live += tracker->slots[i].memory != VK_NULL_HANDLE;
+  }
+
+  uint32_t capacity = tracker->capacity == 0 ? MEMORY_TRACKER_INITIAL_CAPACITY
+                                             : tracker->capacity;
+  while (live * 4 >= capacity) {
+    capacity *= 2;
+  }
+
+  memory_allocation_t *slots = calloc(capacity, sizeof(memory_allocation_t));
+  for (uint32_t i = 0; i < tracker->capacity; i++) {
+    memory_allocation_t *slot = &tracker->slots[i];
+    if (slot->memory != VK_NULL_HANDLE) {
+      *memory_tracker_find_slot(slots, capacity, slot->memory) = *slot;
+    }
+  }
+
+  free(tracker->slots);
+  tracker->slots = slots;
+  tracker->capacity = capacity;
+  tracker->used = live;
+}
+
+void track_allocation(app_t *app, VkDeviceMemory memory, VkDeviceSize size,
+                      uint32_t type) {
+  memory_tracker_t *tracker = &app->memory;
+
+  if ((tracker->used + 1) * 2 > tracker->capacity) {
+    memory_tracker_rehash(tracker);
+  }
+
+  memory_allocation_t *slot =
+      memory_tracker_find_slot(tracker->slots, tracker->capacity, memory);
+  *slot = (memory_allocation_t){.memory = memory, .size = size, .type = type};
+  tracker->used++;
+  tracker->bytes[type] += size;
+  tracker->allocations[type]++;
+}
+
+// vkFreeMemory that keeps the per-type usage current
+void free_memory(app_t *app, VkDeviceMemory memory) {
+  memory_tracker_t *tracker = &app->memory;
+
+  if (memory == VK_NULL_HANDLE) {
+    return;
+  }
+
+  if (tracker->capacity > 0) {
+    memory_allocation_t *slot =
+        memory_tracker_find_slot(tracker->slots, tracker->capacity, memory);
+    if (slot->memory == memory) {
+      tracker->bytes[slot->type] -= slot->size;
+      tracker->allocations[slot->type]--;
+      *slot = (memory_allocation_t){.freed = true};
+    }
+  }
+
+  vkFreeMemory(app->device, memory, NULL);
+}
+
+// Memory with properties | preferred if the buffer can live in any, otherwise
+// just properties
+void create_buffer_preferring(app_t *app, VkDeviceSize size,
+                              VkBufferUsageFlags usage,
+                              VkMemoryPropertyFlags properties,
+                              VkMemoryPropertyFlags preferred,
+                              VkBuffer *buffer, VkDeviceMemory *memory) {
+  VkBufferCreateInfo buffer_info = {0};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = usage;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(app->device, &buffer_info, NULL, buffer) != VK_SUCCESS) {
+    error("failed to create buffer!");
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(app->device, *buffer, &requirements);
+
+  optional_uint32_t type = try_find_memory_type(
+      app, requirements.memoryTypeBits, properties | preferred);
+
+  VkMemoryAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
+  alloc_info.memoryTypeIndex =
+      type.present
+          ? type.value
+          : find_memory_type(app, requirements.memoryTypeBits, properties);
+
+  if (vkAllocateMemory(app->device, &alloc_info, NULL, memory) != VK_SUCCESS) {
+    error("failed to allocate buffer memory!");
+  }
+  track_allocation(app, *memory, alloc_info.allocationSize,
+                   alloc_info.memoryTypeIndex);
+
+  vkBindBufferMemory(app->device, *buffer, *memory, 0);
+}
+
+void create_buffer(app_t *app, VkDeviceSize size, VkBufferUsageFlags usage,
+                   VkMemoryPropertyFlags properties, VkBuffer *buffer,
+                   VkDeviceMemory *memory) {
+  create_buffer_preferring(app, size, usage, properties, 0, buffer, memory);
+}
+
+void create_mapped_buffer(app_t *app, VkDeviceSize size,
+                          VkBufferUsageFlags usage, mapped_buffer_t *out) {
+  create_buffer(app, size, usage,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &out->buffer, &out->memory);
+
+  // Mapped for the buffer's whole lifetime
+  if (vkMapMemory(app->device, out->memory, 0, size, 0, &out->mapped) !=
+      VK_SUCCESS) {
+    error("failed to map buffer memory!");
+  }
+}
+
+void destroy_mapped_buffer(app_t *app, mapped_buffer_t *buffer) {
+  vkUnmapMemory(app->device, buffer->memory);
+  vkDestroyBuffer(app->device, buffer->buffer, NULL);
+  free_memory(app, buffer->memory);
+}
+
+// The caller binds memory
+VkImage create_unbound_image(app_t *app, uint32_t width, uint32_t height,
+                             uint32_t mip_levels, VkFormat format,
+                             VkImageUsageFlags usage) {
+  VkImageCreateInfo image_info = {0};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.extent.width = width;
+  image_info.extent.height = height;
+  image_info.extent.depth = 1;
+  image_info.mipLevels = mip_levels;
+  image_info.arrayLayers = 1;
+  image_info.format = format;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  image_info.usage = usage;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VkImage image;
+  if (vkCreateImage(app->device, &image_info, NULL, &image) != VK_SUCCESS) {
+    error("failed to create image!");
+  }
+
+  return image;
+}
+
+void create_image(app_t *app, uint32_t width, uint32_t height,
+                  uint32_t mip_levels, VkFormat format,
+                  VkImageUsageFlags usage, VkImage *image,
+                  VkDeviceMemory *memory) {
+  *image = create_unbound_image(app, width, height, mip_levels, format, usage);
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(app->device, *image, &requirements);
+
+  VkMemoryAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
+  alloc_info.memoryTypeIndex = find_memory_type(
+      app, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  if (vkAllocateMemory(app->device, &alloc_info, NULL, memory) != VK_SUCCESS) {
+    error("failed to allocate image memory!");
+  }
+  track_allocation(app, *memory, alloc_info.allocationSize,
+                   alloc_info.memoryTypeIndex);
+
+  vkBindImageMemory(app->device, *image, *memory, 0);
+}
+
+VkImageView create_image_view(app_t *app, VkImage image, VkFormat format,
+                              uint32_t mip_levels) {
+  VkImageViewCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  create_info.image = image;
+  create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  create_info.format = format;
+  create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  create_info.subresourceRange.baseMipLevel = 0;
+  create_info.subresourceRange.levelCount = mip_levels;
+  create_info.subresourceRange.baseArrayLayer = 0;
+  create_info.subresourceRange.layerCount = 1;
+
+  VkImageView view;
+  if (vkCreateImageView(app->device, &create_info, NULL, &view) !=
+      VK_SUCCESS) {
+    error("failed to create image view!");
+  }
+
+  return view;
+}
+
+/**********
+ * Commands
+ **********/
+
+void create_command_pool(app_t *app) {
+  queue_family_indices_t indices =
+      find_queue_families(app, app->physical_device);
+
+  VkCommandPoolCreateInfo pool_info = {0};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = app->mode == APP_MODE_COMPUTE
+                                   ? indices.compute_family.value
+                                   : indices.graphics_family.value;
+
+  if (vkCreateCommandPool(app->device, &pool_info, NULL, &app->command_pool) !=
+      VK_SUCCESS) {
+    error("failed to create command pool!");
+  }
+
+  VkCommandBufferAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = app->command_pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+  if (vkAllocateCommandBuffers(app->device, &alloc_info,
+                               app->command_buffers) != VK_SUCCESS) {
+    error("failed to allocate command buffers!");
+  }
+}
+
+VkCommandBuffer begin_single_time_commands(app_t *app) {
+  VkCommandBufferAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandPool = app->command_pool;
+  alloc_info.commandBufferCount = 1;
+
+  VkCommandBuffer command_buffer;
+  vkAllocateCommandBuffers(app->device, &alloc_info, &command_buffer);
+
+  VkCommandBufferBeginInfo begin_info = {0};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &begin_info);
+
+  return command_buffer;
+}
+
+void end_single_time_commands(app_t *app, VkCommandBuffer command_buffer) {
+  vkEndCommandBuffer(command_buffer);
+
+  VkSubmitInfo submit_info = {0};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+
+  vkQueueSubmit(app->graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+  vkQueueWaitIdle(app->graphics_queue);
+
+  vkFreeCommandBuffers(app->device, app->command_pool, 1, &command_buffer);
+}
+
+// Copy data into a new device-local buffer through a staging buffer
+void upload_buffer(app_t *app, const void *data, VkDeviceSize size,
+                   VkBufferUsageFlags usage, VkBuffer *buffer,
+                   VkDeviceMemory *memory) {
+  VkBuffer staging_buffer;
+  VkDeviceMemory staging_memory;
+  create_buffer(app, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &staging_buffer, &staging_memory);
+
+  void *mapped;
+  vkMapMemory(app->device, staging_memory, 0, size, 0, &mapped);
+  memcpy(mapped, data, size);
+  vkUnmapMemory(app->device, staging_memory);
+
+  create_buffer(app, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+
+  VkCommandBuffer command_buffer = begin_single_time_commands(app);
+  VkBufferCopy region = {.srcOffset = 0, .dstOffset = 0, .size = size};
+  vkCmdCopyBuffer(command_buffer, staging_buffer, *buffer, 1, &region);
+  end_single_time_commands(app, command_buffer);
+  app->memory.uploaded_bytes += size;
+
+  vkDestroyBuffer(app->device, staging_buffer, NULL);
+  free_memory(app, staging_memory);
+}
+
+/*******************
+ * Offscreen targets
+ *******************/
+
+// Headless stand-in for a window: one image per frame in flight, so the
+// frame fence alone guards reuse
+void create_offscreen_targets(app_t *app) {
+  window_t target = {0};
+  app->swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+  target.swapchain_extent = (VkExtent2D){WIDTH, HEIGHT};
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    VkImage image;
+    VkDeviceMemory memory;
+    create_image(app, WIDTH, HEIGHT, 1, app->swapchain_image_format,
+                 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                 &image, &memory);
+    da_append(target.swapchain_images, image);
+    da_append(target.offscreen_memories, memory);
+  }
+
+  da_append(app->windows, target);
+}
+
+/*************
+ * Render pass
+ *************/
+
+void create_render_pass(app_t *app) {
+  VkAttachmentDescription color_attachment = {0};
+  color_attachment.format = app->swapchain_image_format;
+  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  color_attachment.finalLayout = app->mode == APP_MODE_WINDOWED
+                                     ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                     : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  VkAttachmentReference color_attachment_ref = {0};
+  color_attachment_ref.attachment = 0;
+  color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {0};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_attachment_ref;
+
+  VkSubpassDependency dependency = {0};
+  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.dstSubpass = 0;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = 0;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  VkRenderPassCreateInfo render_pass_info = {0};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_info.attachmentCount = 1;
+  render_pass_info.pAttachments = &color_attachment;
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = 1;
+  render_pass_info.pDependencies = &dependency;
+
+  if (vkCreateRenderPass(app->device, &render_pass_info, NULL,
+                         &app->render_pass) != VK_SUCCESS) {
+    error("failed to create render pass!");
+  }
+}
+
+/**************
+ * Framebuffers
+ **************/
+
+void create_framebuffers(app_t *app, window_t *window) {
+  window->swapchain_framebuffers = (framebuffers_da_t){0};
+  da_capacity(window->swapchain_framebuffers,
+              window->swapchain_image_views.count);
+  window->swapchain_framebuffers.count = window->swapchain_image_views.count;
+
+  for (uint32_t i = 0; i < window->swapchain_image_views.count; i++) {
+    VkFramebufferCreateInfo framebuffer_info = {0};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = app->render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &window->swapchain_image_views.items[i];
+    framebuffer_info.width = window->swapchain_extent.width;
+    framebuffer_info.height = window->swapchain_extent.height;
+    framebuffer_info.layers = 1;
+
+    if (vkCreateFramebuffer(app->device, &framebuffer_info, NULL,
+                            &window->swapchain_framebuffers.items[i]) !=
+        VK_SUCCESS) {
+      error("failed to create framebuffer!");
+    }
+  }
+}
+
+/******
+ * Sync
+ ******/
+
+void create_sync_objects(app_t *app) {
+  VkSemaphoreCreateInfo semaphore_info = {0};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkFenceCreateInfo fence_info = {0};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    if (vkCreateFence(app->device, &fence_info, NULL,
+                      &app->in_flight_fences[i]) != VK_SUCCESS) {
+      error("failed to create fence!");
+    }
+  }
+
+  if (app->mode != APP_MODE_WINDOWED) {
+    return;
+  }
+
+  // The fences are shared, but each swapchain is acquired from and presented
+  // to on its own
+  for (uint32_t w = 0; w < app->windows.count; w++) {
+    window_t *window = &app->windows.items[w];
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      if (vkCreateSemaphore(app->device, &semaphore_info, NULL,
+                            &window->image_available_semaphores[i]) !=
+          VK_SUCCESS) {
+        error("failed to create semaphore!");
+      }
+    }
+
+    for (uint32_t i = 0; i < window->swapchain_images.count; i++) {
+      VkSemaphore semaphore;
+      if (vkCreateSemaphore(app->device, &semaphore_info, NULL, &semaphore) !=
+          VK_SUCCESS) {
+        error("failed to create semaphore!");
+      }
+      da_append(window->render_finished_semaphores, semaphore);
+    }
+  }
+}
+
+/************
+ * Timestamps
+ ************/
+
+void create_timestamp_pool(app_t *app) {
+  queue_family_indices_t indices =
+      find_queue_families(app, app->physical_device);
+
+  queue_family_properties_da_t queue_families = {0};
+  vkGetPhysicalDeviceQueueFamilyProperties(app->physical_device,
+                                           &queue_families.count, NULL);
+  da_capacity(queue_families, queue_families.count);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      app->physical_device, &queue_families.count, queue_families.items);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+
+  app->timestamps_supported =
+      queue_families.items[indices.graphics_family.value].timestampValidBits >
+      0;
+  app->timestamp_period = properties.limits.timestampPeriod;
+  app->last_gpu_frame_ms = -1.0;
+  da_free(queue_families);
+
+  if (!app->timestamps_supported) {
+    return;
+  }
+
+  VkQueryPoolCreateInfo pool_info = {0};
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = MAX_FRAMES_IN_FLIGHT * 2;
+
+  if (vkCreateQueryPool(app->device, &pool_info, NULL, &app->timestamp_pool) !=
+      VK_SUCCESS) {
+    error("failed to create timestamp query pool!");
+  }
+}
+
+// Must only be called once the frame's fence has signaled
+void read_frame_timestamps(app_t *app, uint32_t frame) {
+  app->last_gpu_frame_ms = -1.0;
+
+  if (!app->timestamps_supported || !app->timestamps_written[frame]) {
+    return;
+  }
+
+  uint64_t timestamps[2];
+  if (vkGetQueryPoolResults(app->device, app->timestamp_pool, frame * 2, 2,
+                            sizeof(timestamps), timestamps, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+    app->last_gpu_frame_ms =
+        (double)(timestamps[1] - timestamps[0]) * app->timestamp_period / 1e6;
+  }
+}
+
+/****************
+ * Deletion queue
+ ****************/
+
+// Resources still referenced by frames in flight are parked on the current
+// frame slot and destroyed once its fence signals again
+void defer_destroy(app_t *app, deferred_destroy_t resource) {
+  da_append(app->deletion_queues[app->current_frame], resource);
+}
+
+void flush_deletion_queue(app_t *app, uint32_t frame) {
+  deferred_destroys_da_t *queue = &app->deletion_queues[frame];
+
+  for (uint32_t i = 0; i < queue->count; i++) {
+    deferred_destroy_t *resource = &queue->items[i];
+    if (resource->view != VK_NULL_HANDLE) {
+      vkDestroyImageView(app->device, resource->view, NULL);
+    }
+    if (resource->image != VK_NULL_HANDLE) {
+      vkDestroyImage(app->device, resource->image, NULL);
+    }
+    if (resource->buffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(app->device, resource->buffer, NULL);
+    }
+    if (resource->memory != VK_NULL_HANDLE) {
+      free_memory(app, resource->memory);
+    }
+    if (resource->descriptor_set != VK_NULL_HANDLE) {
+      vkFreeDescriptorSets(app->device, resource->descriptor_pool, 1,
+                           &resource->descriptor_set);
+    }
+  }
+
+  queue->count = 0;
+}
+
+/*******************
+ * Texture streaming
+ *******************/
+
+// Textures are generated on demand a mip at a time, standing in for reading
+// them from disk. Mips at or below TEXTURE_RESIDENT_MIN_SIZE are loaded up
+// front and never evicted; higher mips are streamed in when a texture covers
+// enough of the screen, and the least recently used are dropped again when
+// over budget.
+
+#define TEXTURE_SIZE 256
+#define TEXTURE_RESIDENT_MIN_SIZE 32
+#define TEXTURE_BUDGET_PERCENT 50
+#define TEXTURE_BUDGET_REFRESH_FRAMES 60
+// Each op creates an image and records its copies, this bounds the work
+#define TEXTURE_STREAM_OPS_PER_FRAME 8
+// Texture images are sub-allocated from blocks of about this size
+#define TEXTURE_BLOCK_BYTES (16 * 1024 * 1024)
+// Size of each frame slot's staging buffer, fits a full chain a few times
+#define TEXTURE_STAGING_BYTES_PER_FRAME (1024 * 1024)
+
+uint32_t texture_mip_count(void) {
+  uint32_t count = 1;
+  for (uint32_t size = TEXTURE_SIZE; size > 1; size /= 2) {
+    count++;
+  }
+  return count;
+}
+
+// Most detailed mip that is always resident
+uint32_t texture_floor_mip(void) {
+  uint32_t mip = 0;
+  for (uint32_t size = TEXTURE_SIZE; size > TEXTURE_RESIDENT_MIN_SIZE;
+       size /= 2) {
+    mip++;
+  }
+  return mip;
+}
+
+VkDeviceSize texture_mip_bytes(uint32_t mip) {
+  VkDeviceSize size = TEXTURE_SIZE >> mip;
+  return size * size * 4;
+}
+
+VkDeviceSize texture_chain_bytes(uint32_t first_mip) {
+  VkDeviceSize bytes = 0;
+  for (uint32_t mip = first_mip; mip < texture_mip_count(); mip++) {
+    bytes += texture_mip_bytes(mip);
+  }
+  return bytes;
+}
+
+VkImage create_texture_image(app_t *app, uint32_t mip) {
+  uint32_t size = TEXTURE_SIZE >> mip;
+  return create_unbound_image(app, size, size, texture_mip_count() - mip,
+                              VK_FORMAT_R8G8B8A8_UNORM,
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                  VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                                  VK_IMAGE_USAGE_SAMPLED_BIT);
+}
+
+// Ask the driver once what each chain length really allocates, so residency
+// is tracked in the same units as the heap budget
+void measure_texture_images(app_t *app) {
+  texture_streaming_t *streaming = &app->streaming;
+
+  for (uint32_t mip = 0; mip < texture_mip_count(); mip++) {
+    VkImage image = create_texture_image(app, mip);
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(app->device, image, &requirements);
+    VkDeviceSize alignment = requirements.alignment;
+    VkDeviceSize bytes =
+        (requirements.size + alignment - 1) / alignment * alignment;
+
+    streaming->image_bytes[mip] = bytes;
+    streaming->image_memory_types[mip] = find_memory_type(
+        app, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    streaming->slots_per_block[mip] =
+        bytes < TEXTURE_BLOCK_BYTES ? TEXTURE_BLOCK_BYTES / bytes : 1;
+
+    vkDestroyImage(app->device, image, NULL);
+  }
+}
+
+// Allocate a block for images holding mips [mip, last] and put all of its
+// slots on the free list
+void allocate_texture_block(app_t *app, uint32_t mip) {
+  texture_streaming_t *streaming = &app->streaming;
+  uint32_t slot_count = streaming->slots_per_block[mip];
+
+  uint32_t block = 0;
+  while (block < streaming->blocks.count &&
+         streaming->blocks.items[block].memory != VK_NULL_HANDLE) {
+    block++;
+  }
+  if (block == streaming->blocks.count) {
+    da_append(streaming->blocks, (texture_block_t){0});
+  }
+
+  VkMemoryAllocateInfo alloc_info = {0};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = streaming->image_bytes[mip] * slot_count;
+  alloc_info.memoryTypeIndex = streaming->image_memory_types[mip];
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(app->device, &alloc_info, NULL, &memory) !=
+      VK_SUCCESS) {
+    error("failed to allocate texture memory!");
+  }
+  track_allocation(app, memory, alloc_info.allocationSize,
+                   alloc_info.memoryTypeIndex);
+
+  streaming->blocks.items[block] = (texture_block_t){
+      .memory = memory, .mip = mip, .free_count = slot_count};
+  streaming->block_bytes += alloc_info.allocationSize;
+  streaming->spare_blocks[mip]++;
+
+  // Backwards, so slots are handed out from the start of the block
+  for (uint32_t i = slot_count; i-- > 0;) {
+    da_append(streaming->free_slots[mip],
+              ((texture_slot_t){.block = block, .index = i}));
+  }
+}
+
+texture_slot_t take_texture_slot(app_t *app, uint32_t mip) {
+  texture_streaming_t *streaming = &app->streaming;
+  texture_slots_da_t *free_slots = &streaming->free_slots[mip];
+
+  if (free_slots->count == 0) {
+    allocate_texture_block(app, mip);
+  }
+
+  texture_slot_t slot = free_slots->items[--free_slots->count];
+  texture_block_t *block = &streaming->blocks.items[slot.block];
+  if (block->free_count == streaming->slots_per_block[mip]) {
+    streaming->spare_blocks[mip]--;
+  }
+  block->free_count--;
+
+  return slot;
+}
+
+// Only once the GPU is done with the image in the slot
+void release_texture_slot(app_t *app, texture_slot_t slot) {
+  texture_streaming_t *streaming = &app->streaming;
+  texture_block_t *block = &streaming->blocks.items[slot.block];
+  uint32_t mip = block->mip;
+  texture_slots_da_t *free_slots = &streaming->free_slots[mip];
+
+  da_append((*free_slots), slot);
+  block->free_count++;
+
+  if (block->free_count < streaming->slots_per_block[mip]) {
+    return;
+  }
+
+  // One empty block stays, so a texture moving back and forth between two
+  // mips doesn't allocate and free a block each time
+  if (streaming->spare_blocks[mip] == 0) {
+    streaming->spare_blocks[mip]++;
+    return;
+  }
+
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < free_slots->count; i++) {
+    if (free_slots->items[i].block != slot.block) {
+      free_slots->items[kept++] = free_slots->items[i];
+    }
+  }
+  free_slots->count = kept;
+
+  streaming->block_bytes -=
+      streaming->image_bytes[mip] * streaming->slots_per_block[mip];
+  free_memory(app, block->memory);
+  block->memory = VK_NULL_HANDLE;
+}
+
+void destroy_texture_blocks(app_t *app) {
+  texture_streaming_t *streaming = &app->streaming;
+
+  for (uint32_t i = 0; i < streaming->blocks.count; i++) {
+    if (streaming->blocks.items[i].memory != VK_NULL_HANDLE) {
+      free_memory(app, streaming->blocks.items[i].memory);
+    }
+  }
+  da_free(streaming->blocks);
+
+  for (uint32_t mip = 0; mip < TEXTURE_MAX_MIPS; mip++) {
+    da_free(streaming->free_slots[mip]);
+  }
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    da_free(streaming->retired_slots[i]);
+  }
+}
+
+void create_texture_staging(app_t *app, VkDeviceSize size,
+                            texture_staging_t *staging) {
+  create_mapped_buffer(app, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                       &staging->buffer);
+  staging->size = size;
+  staging->used = 0;
+}
+
+// Staging bytes rebuilding texture at new_mip needs, mips it already has are
+// copied on the GPU instead
+VkDeviceSize texture_upload_bytes(const texture_t *texture, uint32_t new_mip) {
+  if (texture->image == VK_NULL_HANDLE) {
+    return texture_chain_bytes(new_mip);
+  }
+
+  if (new_mip >= texture->resident_mip) {
+    return 0;
+  }
+
+  return texture_chain_bytes(new_mip) -
+         texture_chain_bytes(texture->resident_mip);
+}
+
+// Two-colour checkerboard with 8 texel squares at mip 0. Once the squares
+// shrink below a texel the mip is the average of both colours.
+void generate_texture_mip(const texture_t *texture, uint32_t mip,
+                          uint8_t *out) {
+  uint32_t size = TEXTURE_SIZE >> mip;
+  uint32_t square = 8 >> mip;
+
+  uint8_t average[4];
+  for (uint32_t channel = 0; channel < 4; channel++) {
+    average[channel] =
+        (texture->colors[0][channel] + texture->colors[1][channel]) / 2;
+  }
+
+  for (uint32_t y = 0; y < size; y++) {
+    for (uint32_t x = 0; x < size; x++) {
+      const uint8_t *color =
+          square == 0 ? average : texture->colors[((x / square) + (y / square)) % 2];
+      memcpy(&out[(y * size + x) * 4], color, 4);
+    }
+  }
+}
+
+void image_barrier(VkCommandBuffer command_buffer, VkImage image,
+                   uint32_t levels, VkImageLayout old_layout,
+                   VkImageLayout new_layout, VkAccessFlags src_access,
+                   VkAccessFlags dst_access, VkPipelineStageFlags src_stage,
+                   VkPipelineStageFlags dst_stage) {
+  VkImageMemoryBarrier barrier = {0};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = levels;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+
+  vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 0,
+                       NULL, 1, &barrier);
+}
+
+descriptor_write_t texture_descriptor_write(app_t *app, VkImageView view) {
+  descriptor_write_t write = {0};
+  write.binding = 0;
+  write.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.image.sampler = app->scene.sampler;
+  write.image.imageView = view;
+  write.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  return write;
+}
+
+// Replace the texture's image with one holding mips [new_mip, last]. Mips
+// both images share are copied on the GPU, missing ones are generated into
+// staging and uploaded; the caller makes sure staging has room for them.
+// Works for streaming in (new_mip < resident_mip), evicting
+// (new_mip > resident_mip) and the initial load (no image yet).
+void rebuild_texture(app_t *app, VkCommandBuffer command_buffer,
+                     texture_t *texture, uint32_t new_mip,
+                     texture_staging_t *staging) {
+  texture_streaming_t *streaming = &app->streaming;
+  uint32_t mip_count = texture_mip_count();
+  uint32_t levels = mip_count - new_mip;
+  texture_t old = *texture;
+  bool has_old = old.image != VK_NULL_HANDLE;
+
+  texture->image = create_texture_image(app, new_mip);
+  texture->slot = take_texture_slot(app, new_mip);
+  texture->bytes = streaming->image_bytes[new_mip];
+  vkBindImageMemory(app->device, texture->image,
+                    streaming->blocks.items[texture->slot.block].memory,
+                    texture->slot.index * texture->bytes);
+  texture->view = create_image_view(app, texture->image,
+                                    VK_FORMAT_R8G8B8A8_UNORM, levels);
+  texture->resident_mip = new_mip;
+  texture->descriptor_set = VK_NULL_HANDLE;
+
+  image_barrier(command_buffer, texture->image, levels,
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  uint32_t first_copied = mip_count;
+  if (has_old) {
+    first_copied =
+        new_mip > old.resident_mip ? new_mip : old.resident_mip;
+
+    image_barrier(command_buffer, old.image, mip_count - old.resident_mip,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    for (uint32_t mip = first_copied; mip < mip_count; mip++) {
+      uint32_t mip_size = TEXTURE_SIZE >> mip;
+      VkImageCopy region = {0};
+      region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.srcSubresource.mipLevel = mip - old.resident_mip;
+      region.srcSubresource.layerCount = 1;
+      region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.dstSubresource.mipLevel = mip - new_mip;
+      region.dstSubresource.layerCount = 1;
+      region.extent = (VkExtent3D){mip_size, mip_size, 1};
+
+      vkCmdCopyImage(command_buffer, old.image,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->image,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    deferred_destroy_t resource = {.image = old.image, .view = old.view};
+    if (old.descriptor_set != VK_NULL_HANDLE) {
+      descriptor_write_t write = texture_descriptor_write(app, old.view);
+      evict_immutable_descriptor_set(app, app->scene.set_layout, &write, 1,
+                                     &resource.descriptor_pool,
+                                     &resource.descriptor_set);
+    }
+    defer_destroy(app, resource);
+    da_append(streaming->retired_slots[app->current_frame], old.slot);
+    streaming->resident_bytes -= old.bytes;
+  }
+
+  if (new_mip < first_copied) {
+    VkDeviceSize staging_size =
+        texture_chain_bytes(new_mip) - texture_chain_bytes(first_copied);
+    assert(staging->used + staging_size <= staging->size);
+
+    uint8_t *pixels = staging->buffer.mapped;
+    VkDeviceSize offset = staging->used;
+    for (uint32_t mip = new_mip; mip < first_copied; mip++) {
+      uint32_t mip_size = TEXTURE_SIZE >> mip;
+      generate_texture_mip(texture, mip, pixels + offset);
+
+      VkBufferImageCopy region = {0};
+      region.bufferOffset = offset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = mip - new_mip;
+      region.imageSubresource.layerCount = 1;
+      region.imageExtent = (VkExtent3D){mip_size, mip_size, 1};
+      vkCmdCopyBufferToImage(command_buffer, staging->buffer.buffer,
+                             texture->image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+      offset += texture_mip_bytes(mip);
+    }
+
+    staging->used = offset;
+    streaming->uploaded_bytes += staging_size;
+    app->memory.uploaded_bytes += staging_size;
+  }
+
+  image_barrier(command_buffer, texture->image, levels,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  streaming->resident_bytes += texture->bytes;
+}
+
+// Remember the most detailed mip any draw this frame wants. footprint is
+// the texture's on-screen size in pixels.
+void mark_texture_used(app_t *app, texture_t *texture, float footprint) {
+  uint32_t desired = 0;
+  for (float texels = TEXTURE_SIZE; texels > footprint * 2.0f &&
+                                    desired + 1 < texture_mip_count();
+       texels /= 2.0f) {
+    desired++;
+  }
+
+  if (texture->last_used_frame != app->frame_number ||
+      desired < texture->desired_mip) {
+    texture->desired_mip = desired;
+  }
+  texture->last_used_frame = app->frame_number;
+}
+
+void update_texture_budget(app_t *app) {
+  texture_streaming_t *streaming = &app->streaming;
+
+  VkPhysicalDeviceMemoryProperties properties;
+  vkGetPhysicalDeviceMemoryProperties(app->physical_device, &properties);
+
+  uint32_t heap = 0;
+  for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+    if ((properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+        properties.memoryHeaps[i].size > properties.memoryHeaps[heap].size) {
+      heap = i;
+    }
+  }
+
+  VkDeviceSize available = properties.memoryHeaps[heap].size;
+
+  PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2 =
+      (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+          app->instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+
+  if (streaming->memory_budget_supported && get_memory_properties2 != NULL) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {0};
+    budget.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR properties2 = {0};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties2.pNext = &budget;
+    get_memory_properties2(app->physical_device, &properties2);
+
+    // heapUsage includes our own texture blocks, which we are free to
+    // shuffle
+    VkDeviceSize used_by_others =
+        budget.heapUsage[heap] > streaming->block_bytes
+            ? budget.heapUsage[heap] - streaming->block_bytes
+            : 0;
+    available = budget.heapBudget[heap] > used_by_others
+                    ? budget.heapBudget[heap] - used_by_others
+                    : 0;
+  }
+
+  streaming->budget = streaming->budget_override > 0
+                          ? streaming->budget_override
+                          : available / 100 * TEXTURE_BUDGET_PERCENT;
+}
+
+// Least recently used texture that has mips above the floor and was not
+// drawn last frame, or NULL
+texture_t *find_eviction_candidate(app_t *app, const texture_t *keep) {
+  textures_da_t *textures = &app->scene.textures;
+  texture_t *candidate = NULL;
+
+  for (uint32_t i = 0; i < textures->count; i++) {
+    texture_t *texture = &textures->items[i];
+    if (texture == keep || texture->resident_mip >= texture_floor_mip() ||
+        texture->last_used_frame + 1 >= app->frame_number) {
+      continue;
+    }
+
+    if (candidate == NULL ||
+        texture->last_used_frame < candidate->last_used_frame) {
+      candidate = texture;
+    }
+  }
+
+  return candidate;
+}
+
+// Record this frame's uploads and evictions, before the render pass
+void update_texture_streaming(app_t *app, VkCommandBuffer command_buffer) {
+  texture_streaming_t *streaming = &app->streaming;
+  textures_da_t *textures = &app->scene.textures;
+  uint32_t ops = 0;
+
+  // The slot's last uploads finished before its fence signalled, and the
+  // images it replaced have been destroyed since
+  texture_staging_t *staging = &streaming->staging[app->current_frame];
+  staging->used = 0;
+
+  texture_slots_da_t *retired = &streaming->retired_slots[app->current_frame];
+  for (uint32_t i = 0; i < retired->count; i++) {
+    release_texture_slot(app, retired->items[i]);
+  }
+  retired->count = 0;
+
+  if (app->frame_number % TEXTURE_BUDGET_REFRESH_FRAMES == 0) {
+    update_texture_budget(app);
+  }
+
+  // Budget shrank below what is resident
+  while (streaming->resident_bytes > streaming->budget &&
+         ops < TEXTURE_STREAM_OPS_PER_FRAME) {
+    texture_t *victim = find_eviction_candidate(app, NULL);
+    if (victim == NULL) {
+      break;
+    }
+    rebuild_texture(app, command_buffer, victim, victim->resident_mip + 1,
+                    staging);
+    streaming->evictions++;
+    ops++;
+  }
+
+  // Round-robin so a large texture set doesn't starve the tail
+  for (uint32_t n = 0;
+       n < textures->count && ops < TEXTURE_STREAM_OPS_PER_FRAME; n++) {
+    uint32_t i = (streaming->cursor + n) % textures->count;
+    texture_t *texture = &textures->items[i];
+
+    if (texture->desired_mip >= texture->resident_mip ||
+        texture->last_used_frame + 1 < app->frame_number) {
+      continue;
+    }
+
+    VkDeviceSize extra =
+        streaming->image_bytes[texture->desired_mip] - texture->bytes;
+
+    while (streaming->resident_bytes + extra > streaming->budget &&
+           ops < TEXTURE_STREAM_OPS_PER_FRAME) {
+      texture_t *victim = find_eviction_candidate(app, texture);
+      if (victim == NULL) {
+        break;
+      }
+      rebuild_texture(app, command_buffer, victim, victim->resident_mip + 1,
+                      staging);
+      streaming->evictions++;
+      ops++;
+    }
+
+    // Out of budget, ops or staging space, try again next frame
+    VkDeviceSize upload = texture_upload_bytes(texture, texture->desired_mip);
+    if (streaming->resident_bytes + extra > streaming->budget ||
+        ops >= TEXTURE_STREAM_OPS_PER_FRAME ||
+        staging->used + upload > staging->size) {
+      streaming->cursor = i;
+      break;
+    }
+
+    rebuild_texture(app, command_buffer, texture, texture->desired_mip,
+                    staging);
+    streaming->uploads++;
+    ops++;
+    streaming->cursor = (i + 1) % textures->count;
+  }
+}
+
+/*********
+ * Capture
+ *********/
+
+// Frames are copied into a ring of host-visible buffers at the end of the
+// command buffer and handed to an encode worker once the frame's fence has
+// signalled, so capturing never waits on the GPU. When every buffer is still
+// in use the frame is skipped and counted as dropped.
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+// Worst case is one RGBA op per pixel
+size_t qoi_max_size(uint32_t width, uint32_t height) {
+  return (size_t)width * height * 5 + QOI_HEADER_SIZE + QOI_PADDING_SIZE;
+}
+
+void qoi_write_u32(uint8_t *out, size_t *p, uint32_t value) {
+  out[(*p)++] = value >> 24;
+  out[(*p)++] = value >> 16;
+  out[(*p)++] = value >> 8;
+  out[(*p)++] = value;
+}
+
+// https://qoiformat.org/qoi-specification.pdf. pixels are tightly packed
+// RGBA8, or BGRA8 with swizzle set. Returns the encoded size.
+size_t qoi_encode(const uint8_t *pixels, uint32_t width, uint32_t height,
+                  bool swizzle, uint8_t *out) {
+  size_t p = 0;
+  out[p++] = 'q';
+  out[p++] = 'o';
+  out[p++] = 'i';
+  out[p++] = 'f';
+  qoi_write_u32(out, &p, width);
+  qoi_write_u32(out, &p, height);
+  out[p++] = 4;
+  out[p++] = 0;
+
+  uint8_t index[64][4] = {0};
+  uint8_t previous[4] = {0, 0, 0, 255};
+  uint32_t run = 0;
+  size_t pixel_count = (size_t)width * height;
+
+  for (size_t i = 0; i < pixel_count; i++) {
+    const uint8_t *source = &pixels[i * 4];
+    uint8_t px[4] = {source[swizzle ? 2 : 0], source[1],
+                     source[swizzle ? 0 : 2], source[3]};
+
+    if (memcmp(px, previous, 4) == 0) {
+      run++;
+      if (run == 62 || i == pixel_count - 1) {
+        out[p++] = 0xc0 | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0) {
+      out[p++] = 0xc0 | (run - 1);
+      run = 0;
+    }
+
+    uint32_t hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+
+    if (memcmp(index[hash], px, 4) == 0) {
+      out[p++] = hash;
+    } else {
+      memcpy(index[hash], px, 4);
+
+      if (px[3] == previous[3]) {
+        int8_t dr = (int8_t)(px[0] - previous[0]);
+        int8_t dg = (int8_t)(px[1] - previous[1]);
+        int8_t db = (int8_t)(px[2] - previous[2]);
+        int8_t dr_dg = dr - dg;
+        int8_t db_dg = db - dg;
+
+        if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+          out[p++] = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 &&
+                   db_dg > -9 && db_dg < 8) {
+          out[p++] = 0x80 | (dg + 32);
+          out[p++] = (dr_dg + 8) << 4 | (db_dg + 8);
+        } else {
+          out[p++] = 0xfe;
+          out[p++] = px[0];
+          out[p++] = px[1];
+          out[p++] = px[2];
+        }
+      } else {
+        out[p++] = 0xff;
+        memcpy(&out[p], px, 4);
+        p += 4;
+      }
+    }
+
+    memcpy(previous, px, 4);
+  }
+
+  for (uint32_t i = 0; i < QOI_PADDING_SIZE - 1; i++) {
+    out[p++] = 0;
+  }
+  out[p++] = 1;
+
+  return p;
+}
+
+void encode_capture(capture_t *capture, capture_slot_t *slot,
+                    uint8_t *scratch) {
+  size_t row_bytes = (size_t)capture->width * 4;
+
+  if (capture->directory != NULL) {
+    size_t size = qoi_encode(slot->mapped, capture->width, capture->height,
+                             capture->swizzle, scratch);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%06llu.qoi", capture->directory,
+             (unsigned long long)slot->frame_number);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+      fprintf(stderr, "failed to open %s for writing\n", path);
+      return;
+    }
+    fwrite(scratch, 1, size, file);
+    fclose(file);
+    capture->encoded_bytes += size;
+  }
+
+  // Rows are swizzled to RGBA through scratch, which holds a whole QOI frame
+  if (capture->raw_stream != NULL) {
+    for (uint32_t y = 0; y < capture->height; y++) {
+      const uint8_t *row = slot->mapped + y * row_bytes;
+
+      if (capture->swizzle) {
+        for (uint32_t x = 0; x < capture->width; x++) {
+          scratch[x * 4 + 0] = row[x * 4 + 2];
+          scratch[x * 4 + 1] = row[x * 4 + 1];
+          scratch[x * 4 + 2] = row[x * 4 + 0];
+          scratch[x * 4 + 3] = row[x * 4 + 3];
+        }
+        row = scratch;
+      }
+
+      fwrite(row, 1, row_bytes, capture->raw_stream);
+    }
+    capture->encoded_bytes += row_bytes * capture->height;
+  }
+}
+
+void *capture_worker(void *arg) {
+  capture_t *capture = arg;
+  uint8_t *scratch = malloc(qoi_max_size(capture->width, capture->height));
+
+  pthread_mutex_lock(&capture->mutex);
+
+  while (true) {
+    while (capture->running && capture->queue_count == 0) {
+      pthread_cond_wait(&capture->cond, &capture->mutex);
+    }
+
+    // Drain what is queued before stopping, so no captured frame is lost
+    if (capture->queue_count == 0) {
+      break;
+    }
+
+    uint32_t index = capture->queue[capture->queue_head];
+    capture->queue_head = (capture->queue_head + 1) % CAPTURE_RING_SIZE;
+    capture->queue_count--;
+    pthread_mutex_unlock(&capture->mutex);
+
+    encode_capture(capture, &capture->slots[index], scratch);
+
+    pthread_mutex_lock(&capture->mutex);
+    capture->slots[index].state = CAPTURE_SLOT_FREE;
+  }
+
+  pthread_mutex_unlock(&capture->mutex);
+  free(scratch);
+  return NULL;
+}
+
+void create_capture(app_t *app, const char *directory, const char *raw_path,
+                    uint32_t every) {
+  capture_t *capture = &app->capture;
+  capture->directory = directory;
+  capture->every = every;
+  // Only the first window is captured
+  window_t *window = &app->windows.items[0];
+  capture->width = window->swapchain_extent.width;
+  capture->height = window->swapchain_extent.height;
+
+  switch (app->swapchain_image_format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    capture->swizzle = false;
+    break;
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    capture->swizzle = true;
+    break;
+  default:
+    error("can't capture swapchain format %d!", app->swapchain_image_format);
+  }
+
+  if (app->mode == APP_MODE_WINDOWED && !window->swapchain_transfer_src) {
+    error("swapchain images can't be copied from, can't capture!");
+  }
+
+  if (directory != NULL && mkdir(directory, 0755) != 0 && errno != EEXIST) {
+    error("failed to create capture directory %s!", directory);
+  }
+
+  if (raw_path != NULL) {
+    capture->raw_stream = fopen(raw_path, "wb");
+    if (capture->raw_stream == NULL) {
+      error("failed to open %s for writing!", raw_path);
+    }
+  }
+
+  VkDeviceSize size = (VkDeviceSize)capture->width * capture->height * 4;
+  for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+    capture_slot_t *slot = &capture->slots[i];
+    // Cached memory where the buffer allows it, the worker reads every byte
+    create_buffer_preferring(app, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                             &slot->buffer, &slot->memory);
+    vkMapMemory(app->device, slot->memory, 0, size, 0,
+                (void **)&slot->mapped);
+  }
+
+  pthread_mutex_init(&capture->mutex, NULL);
+  pthread_cond_init(&capture->cond, NULL);
+  capture->running = true;
+
+  if (pthread_create(&capture->worker, NULL, capture_worker, capture) != 0) {
+    error("failed to start capture worker!");
+  }
+}
+
+// Record a copy of the rendered image after the render pass, if this frame
+// is due and a readback buffer is free
+void record_capture(app_t *app, VkCommandBuffer command_buffer,
+                    window_t *window) {
+  capture_t *capture = &app->capture;
+
+  if (capture->every == 0 || app->frame_number % capture->every != 0) {
+    return;
+  }
+
+  capture_slot_t *slot = NULL;
+  pthread_mutex_lock(&capture->mutex);
+  for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+    if (capture->slots[i].state == CAPTURE_SLOT_FREE) {
+      slot = &capture->slots[i];
+      slot->state = CAPTURE_SLOT_PENDING;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&capture->mutex);
+
+  if (slot == NULL) {
+    capture->dropped++;
+    return;
+  }
+
+  slot->frame_slot = app->current_frame;
+  slot->frame_number = app->frame_number;
+
+  VkImage image = window->swapchain_images.items[window->image_index];
+  // Headless targets already end the render pass ready to be copied
+  VkImageLayout final_layout = app->mode == APP_MODE_WINDOWED
+                                   ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                   : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  image_barrier(command_buffer, image, 1, final_layout,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  VkBufferImageCopy region = {0};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = (VkExtent3D){capture->width, capture->height, 1};
+  vkCmdCopyImageToBuffer(command_buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1,
+                         &region);
+
+  image_barrier(command_buffer, image, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, final_layout,
+                VK_ACCESS_TRANSFER_READ_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+  VkMemoryBarrier barrier = {0};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0,
+                       NULL);
+}
+
+// Queue the copies made by a frame slot whose fence has just signalled
+void collect_captures(app_t *app, uint32_t frame) {
+  capture_t *capture = &app->capture;
+
+  if (capture->every == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&capture->mutex);
+  for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+    capture_slot_t *slot = &capture->slots[i];
+    if (slot->state != CAPTURE_SLOT_PENDING || slot->frame_slot != frame) {
+      continue;
+    }
+
+    slot->state = CAPTURE_SLOT_ENCODING;
+    uint32_t tail =
+        (capture->queue_head + capture->queue_count) % CAPTURE_RING_SIZE;
+    capture->queue[tail] = i;
+    capture->queue_count++;
+    capture->captured++;
+  }
+  pthread_cond_broadcast(&capture->cond);
+  pthread_mutex_unlock(&capture->mutex);
+}
+
+// Expects the device to be idle
+void destroy_capture(app_t *app) {
+  capture_t *capture = &app->capture;
+
+  if (capture->every == 0) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    collect_captures(app, i);
+  }
+
+  pthread_mutex_lock(&capture->mutex);
+  capture->running = false;
+  pthread_cond_broadcast(&capture->cond);
+  pthread_mutex_unlock(&capture->mutex);
+  pthread_join(capture->worker, NULL);
+
+  for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+    vkUnmapMemory(app->device, capture->slots[i].memory);
+    vkDestroyBuffer(app->device, capture->slots[i].buffer, NULL);
+    free_memory(app, capture->slots[i].memory);
+  }
+
+  if (capture->raw_stream != NULL) {
+    fclose(capture->raw_stream);
+  }
+
+  printf("capture: %llu frames (%.1f MiB written), %llu dropped\n",
+         (unsigned long long)capture->captured,
+         capture->encoded_bytes / 1048576.0,
+         (unsigned long long)capture->dropped);
+
+  pthread_mutex_destroy(&capture->mutex);
+  pthread_cond_destroy(&capture->cond);
+}
+
+/****************
+ * Mesh ingestion
+ ****************/
+
+// Procedural meshes go through the same steps a loaded asset would:
+// deduplicate, reorder for the post-transform cache and for vertex fetch,
+// build a LOD chain, quantize, and append to the shared mesh buffers.
+
+// Models the hardware post-transform cache in the statistics
+#define MESH_FIFO_CACHE_SIZE 16
+// What the reordering optimizes for
+#define MESH_LRU_CACHE_SIZE 32
+// Grid cells per axis for LOD 1, halved for each further level
+#define MESH_LOD_CELLS 16
+#define MESH_LOD_MIN_TRIANGLES 32
+// On-screen size in pixels below which LOD 1 is used, halved per level
+#define MESH_LOD_PIXELS 256.0f
+
+typedef struct {
+  float position[3];
+  float normal[3];
+  float uv[2];
+} mesh_vertex_t;
+
+// What actually goes into the vertex buffer: half-float position (w is
+// padding), octahedral snorm16 normal, unorm16 uv. Half of mesh_vertex_t.
+typedef struct {
+  uint16_t position[4];
+  int16_t normal[2];
+  uint16_t uv[2];
+} packed_vertex_t;
+
+typedef struct {
+  packed_vertex_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} packed_vertices_da_t;
+
+typedef struct {
+  uint16_t *items;
+  uint32_t count;
+  uint32_t capacity;
+} uint16_da_t;
+
+typedef enum {
+  MESH_SHAPE_SPHERE,
+  MESH_SHAPE_TORUS,
+  MESH_SHAPE_WAVE,
+  MESH_SHAPE_COUNT,
+} mesh_shape_t;
+
+// Grid columns and rows per shape
+const uint32_t mesh_shape_grids[MESH_SHAPE_COUNT][2] = {
+    {64, 32},
+    {64, 24},
+    {48, 48},
+};
+
+mesh_vertex_t mesh_shape_vertex(mesh_shape_t shape, uint32_t column,
+                                uint32_t row) {
+  float u = (float)column / mesh_shape_grids[shape][0];
+  float v = (float)row / mesh_shape_grids[shape][1];
+  mesh_vertex_t vertex = {.uv = {u, v}};
+  float theta = u * 2.0f * (float)M_PI;
+
+  switch (shape) {
+  case MESH_SHAPE_SPHERE: {
+    float phi = v * (float)M_PI;
+    float normal[3] = {sinf(phi) * cosf(theta), sinf(phi) * sinf(theta),
+                       cosf(phi)};
+    for (uint32_t i = 0; i < 3; i++) {
+      vertex.normal[i] = normal[i];
+      vertex.position[i] = normal[i] * 0.9f;
+    }
+    break;
+  }
+  case MESH_SHAPE_TORUS: {
+    float phi = v * 2.0f * (float)M_PI;
+    float ring = 0.65f + 0.3f * cosf(phi);
+    vertex.position[0] = ring * cosf(theta);
+    vertex.position[1] = ring * sinf(theta);
+    vertex.position[2] = 0.3f * sinf(phi);
+    vertex.normal[0] = cosf(phi) * cosf(theta);
+    vertex.normal[1] = cosf(phi) * sinf(theta);
+    vertex.normal[2] = sinf(phi);
+    break;
+  }
+  default: {
+    float x = u * 2.0f - 1.0f;
+    float y = v * 2.0f - 1.0f;
+    float k = 3.0f * (float)M_PI;
+    float dx = 0.15f * k * cosf(k * x) * cosf(k * y);
+    float dy = -0.15f * k * sinf(k * x) * sinf(k * y);
+    float length = sqrtf(dx * dx + dy * dy + 1.0f);
+    vertex.position[0] = x;
+    vertex.position[1] = y;
+    vertex.position[2] = 0.15f * sinf(k * x) * cosf(k * y);
+    vertex.normal[0] = -dx / length;
+    vertex.normal[1] = -dy / length;
+    vertex.normal[2] = 1.0f / length;
+    break;
+  }
+  }
+
+  return vertex;
+}
+
+// Unindexed, three vertices per triangle, like most interchange formats
+// hand it over. Returns the vertex count.
+uint32_t generate_mesh_soup(mesh_shape_t shape, mesh_vertex_t **out) {
+  uint32_t columns = mesh_shape_grids[shape][0];
+  uint32_t rows = mesh_shape_grids[shape][1];
+  uint32_t count = columns * rows * 6;
+  mesh_vertex_t *vertices = malloc(count * sizeof(mesh_vertex_t));
+
+  const uint32_t quad[6][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+  uint32_t n = 0;
+
+  for (uint32_t row = 0; row < rows; row++) {
+    for (uint32_t column = 0; column < columns; column++) {
+      for (uint32_t corner = 0; corner < 6; corner++) {
+        vertices[n++] = mesh_shape_vertex(shape, column + quad[corner][0],
+                                          row + quad[corner][1]);
+      }
+    }
+  }
+
+  *out = vertices;
+  return count;
+}
+
+// Merge bitwise identical vertices. Compacts vertices in place, writes one
+// index per input vertex and returns the unique count.
+uint32_t deduplicate_vertices(mesh_vertex_t *vertices, uint32_t vertex_count,
+                              uint32_t *indices) {
+  uint32_t capacity = 1;
+  while (capacity < vertex_count * 2) {
+    capacity *= 2;
+  }
+
+  uint32_t *table = malloc(capacity * sizeof(uint32_t));
+  memset(table, 0xff, capacity * sizeof(uint32_t));
+  uint32_t unique = 0;
+
+  for (uint32_t i = 0; i < vertex_count; i++) {
+    uint32_t slot =
+        hash_bytes(&vertices[i], sizeof(mesh_vertex_t)) & (capacity - 1);
+
+    while (true) {
+      uint32_t existing = table[slot];
+
+      if (existing == UINT32_MAX) {
+        table[slot] = unique;
+        vertices[unique] = vertices[i];
+        indices[i] = unique++;
+        break;
+      }
+
+      if (memcmp(&vertices[existing], &vertices[i], sizeof(mesh_vertex_t)) ==
+          0) {
+        indices[i] = existing;
+        break;
+      }
+
+      slot = (slot + 1) & (capacity - 1);
+    }
+  }
+
+  free(table);
+  return unique;
+}
+
+// Average cache miss ratio: vertex shader invocations per triangle with a
+// FIFO post-transform cache. 0.5 is ideal for a regular grid, 3 is no reuse.
+float simulate_vertex_cache(const uint32_t *indices, uint32_t index_count,
+                            uint32_t vertex_count) {
+  uint32_t *inserted = calloc(vertex_count, sizeof(uint32_t));
+  uint32_t time = MESH_FIFO_CACHE_SIZE + 1;
+  uint32_t misses = 0;
+
+  for (uint32_t i = 0; i < index_count; i++) {
+    uint32_t vertex = indices[i];
+    if (time - inserted[vertex] > MESH_FIFO_CACHE_SIZE) {
+      inserted[vertex] = time++;
+      misses++;
+    }
+  }
+
+  free(inserted);
+  return index_count > 0 ? (float)misses / (index_count / 3) : 0.0f;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization
+float forsyth_vertex_score(int32_t cache_position, uint32_t live_triangles) {
+  if (live_triangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // The last triangle's vertices score slightly lower, so the next
+    // triangle doesn't just fan around one of them
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      score = powf(1.0f - (float)(cache_position - 3) /
+                              (MESH_LRU_CACHE_SIZE - 3),
+                   1.5f);
+    }
+  }
+
+  // Favour vertices with few triangles left, to finish them off
+  return score + 2.0f / sqrtf((float)live_triangles);
+}
+
+void optimize_vertex_cache(uint32_t *indices, uint32_t index_count,
+                           uint32_t vertex_count) {
+  uint32_t triangle_count = index_count / 3;
+
+  // Triangles per vertex. The ones not emitted yet are kept at the front of
+  // each vertex's range, live[v] long.
+  uint32_t *live = calloc(vertex_count, sizeof(uint32_t));
+  uint32_t *offsets = malloc((vertex_count + 1) * sizeof(uint32_t));
+  uint32_t *adjacency = malloc(index_count * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < index_count; i++) {
+    live[indices[i]]++;
+  }
+
+  offsets[0] = 0;
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+    live[v] = 0;
+  }
+
+  for (uint32_t i = 0; i < index_count; i++) {
+    uint32_t v = indices[i];
+    adjacency[offsets[v] + live[v]++] = i / 3;
+  }
+
+  int32_t *cache_position = malloc(vertex_count * sizeof(int32_t));
+  float *vertex_score = malloc(vertex_count * sizeof(float));
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    cache_position[v] = -1;
+    vertex_score[v] = forsyth_vertex_score(-1, live[v]);
+  }
+
+  bool *emitted = calloc(triangle_count, sizeof(bool));
+  uint32_t *out = malloc(index_count * sizeof(uint32_t));
+  uint32_t cache[MESH_LRU_CACHE_SIZE + 3];
+  uint32_t cache_count = 0;
+  uint32_t cursor = 0;
+  int64_t best = -1;
+
+  for (uint32_t n = 0; n < triangle_count; n++) {
+    // Nothing in the cache has triangles left, take the next in input order
+    if (best < 0) {
+      while (emitted[cursor]) {
+        cursor++;
+      }
+      best = cursor;
+    }
+
+    uint32_t triangle = (uint32_t)best;
+    emitted[triangle] = true;
+
+    uint32_t new_cache[MESH_LRU_CACHE_SIZE + 3];
+    uint32_t new_count = 0;
+
+    for (uint32_t k = 0; k < 3; k++) {
+      uint32_t v = indices[triangle * 3 + k];
+      out[n * 3 + k] = v;
+      new_cache[new_count++] = v;
+
+      uint32_t *list = &adjacency[offsets[v]];
+      for (uint32_t j = 0; j < live[v]; j++) {
+        if (list[j] == triangle) {
+          list[j] = list[live[v] - 1];
+          list[live[v] - 1] = triangle;
+          live[v]--;
+          break;
+        }
+      }
+    }
+
+    for (uint32_t c = 0; c < cache_count; c++) {
+      uint32_t v = cache[c];
+      if (v != new_cache[0] && v != new_cache[1] && v != new_cache[2]) {
+        new_cache[new_count++] = v;
+      }
+    }
+
+    // Up to three vertices fall out of the cache and lose their bonus
+    for (uint32_t c = 0; c < new_count; c++) {
+      uint32_t v = new_cache[c];
+      cache_position[v] = c < MESH_LRU_CACHE_SIZE ? (int32_t)c : -1;
+      vertex_score[v] = forsyth_vertex_score(cache_position[v], live[v]);
+    }
+
+    // Only triangles touching the cache changed score
+    best = -1;
+    float best_score = -1.0f;
+    for (uint32_t c = 0; c < new_count; c++) {
+      uint32_t v = new_cache[c];
+      for (uint32_t j = 0; j < live[v]; j++) {
+        uint32_t candidate = adjacency[offsets[v] + j];
+        const uint32_t *corners = &indices[candidate * 3];
+        float score = vertex_score[corners[0]] + vertex_score[corners[1]] +
+                      vertex_score[corners[2]];
+        if (score > best_score) {
+          best_score = score;
+          best = candidate;
+        }
+      }
+    }
+
+    cache_count =
+        new_count < MESH_LRU_CACHE_SIZE ? new_count : MESH_LRU_CACHE_SIZE;
+    memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+  }
+
+  memcpy(indices, out, index_count * sizeof(uint32_t));
+
+  free(out);
+  free(emitted);
+  free(vertex_score);
+  free(cache_position);
+  free(adjacency);
+  free(offsets);
+  free(live);
+}
+
+// Renumber vertices in order of first use so fetches walk the vertex buffer
+// forwards, dropping unreferenced ones. Returns the new vertex count.
+uint32_t optimize_vertex_fetch(mesh_vertex_t *vertices, uint32_t vertex_count,
+                               uint32_t *indices, uint32_t index_count) {
+  uint32_t *remap = malloc(vertex_count * sizeof(uint32_t));
+  memset(remap, 0xff, vertex_count * sizeof(uint32_t));
+  mesh_vertex_t *reordered = malloc(vertex_count * sizeof(mesh_vertex_t));
+  uint32_t next = 0;
+
+  for (uint32_t i = 0; i < index_count; i++) {
+    uint32_t v = indices[i];
+    if (remap[v] == UINT32_MAX) {
+      remap[v] = next;
+      reordered[next++] = vertices[v];
+    }
+    indices[i] = remap[v];
+  }
+
+  memcpy(vertices, reordered, next * sizeof(mesh_vertex_t));
+
+  free(reordered);
+  free(remap);
+  return next;
+}
+
+// Vertex clustering: snap vertices to a cells^3 grid over the bounds and
+// collapse each cell onto the first vertex in it, dropping triangles that
+// become degenerate. Writes to out and returns its length.
+uint32_t simplify_mesh(const mesh_vertex_t *vertices, uint32_t vertex_count,
+                       const uint32_t *indices, uint32_t index_count,
+                       uint32_t cells, uint32_t *out) {
+  float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+  float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      min[axis] = fminf(min[axis], vertices[v].position[axis]);
+      max[axis] = fmaxf(max[axis], vertices[v].position[axis]);
+    }
+  }
+
+  uint32_t *representative = malloc(cells * cells * cells * sizeof(uint32_t));
+  memset(representative, 0xff, cells * cells * cells * sizeof(uint32_t));
+  uint32_t *remap = malloc(vertex_count * sizeof(uint32_t));
+
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    uint32_t cell = 0;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      float extent = max[axis] - min[axis];
+      float t = extent > 0.0f
+                    ? (vertices[v].position[axis] - min[axis]) / extent
+                    : 0.0f;
+      uint32_t coordinate = (uint32_t)(t * cells);
+      if (coordinate >= cells) {
+        coordinate = cells - 1;
+      }
+      cell = cell * cells + coordinate;
+    }
+
+    if (representative[cell] == UINT32_MAX) {
+      representative[cell] = v;
+    }
+    remap[v] = representative[cell];
+  }
+
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < index_count; i += 3) {
+    uint32_t a = remap[indices[i]];
+    uint32_t b = remap[indices[i + 1]];
+    uint32_t c = remap[indices[i + 2]];
+    if (a != b && b != c && a != c) {
+      out[count++] = a;
+      out[count++] = b;
+      out[count++] = c;
+    }
+  }
+
+  free(remap);
+  free(representative);
+  return count;
+}
+
+// Round to nearest. Values below the half range flush to zero, above it
+// (and NaN) become infinity.
+uint16_t float_to_half(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (exponent <= 0) {
+    return sign;
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+
+  // A carry out of the mantissa correctly bumps the exponent
+  uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+  if (mantissa & 0x1000) {
+    half++;
+  }
+  return half;
+}
+
+int16_t float_to_snorm16(float value) {
+  float clamped = clamp(value, -1.0f, 1.0f);
+  return (int16_t)lrintf(clamped * 32767.0f);
+}
+
+uint16_t float_to_unorm16(float value) {
+  float clamped = clamp(value, 0.0f, 1.0f);
+  return (uint16_t)lrintf(clamped * 65535.0f);
+}
+
+// Project the unit normal onto an octahedron and unfold it into a square
+void encode_octahedral(const float normal[3], int16_t out[2]) {
+  float length =
+      fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+  float x = normal[0] / length;
+  float y = normal[1] / length;
+
+  if (normal[2] < 0.0f) {
+    float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = folded_x;
+    y = folded_y;
+  }
+
+  out[0] = float_to_snorm16(x);
+  out[1] = float_to_snorm16(y);
+}
+
+packed_vertex_t pack_vertex(const mesh_vertex_t *vertex) {
+  packed_vertex_t packed = {0};
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    packed.position[axis] = float_to_half(vertex->position[axis]);
+  }
+  packed.position[3] = float_to_half(1.0f);
+  encode_octahedral(vertex->normal, packed.normal);
+  packed.uv[0] = float_to_unorm16(vertex->uv[0]);
+  packed.uv[1] = float_to_unorm16(vertex->uv[1]);
+  return packed;
+}
+
+// Reorder, quantize and append one LOD to the shared buffers. indices refer
+// to vertices, which is left compacted to just this LOD's vertices.
+mesh_lod_t append_mesh_lod(mesh_vertex_t *vertices, uint32_t vertex_count,
+                           uint32_t *indices, uint32_t index_count,
+                           packed_vertices_da_t *packed_vertices,
+                           uint16_da_t *packed_indices) {
+  optimize_vertex_cache(indices, index_count, vertex_count);
+  vertex_count =
+      optimize_vertex_fetch(vertices, vertex_count, indices, index_count);
+
+  // 16-bit indices relative to the LOD's vertex_offset
+  if (vertex_count > UINT16_MAX + 1) {
+    error("mesh LOD has %u vertices, more than 16-bit indices can address!",
+          vertex_count);
+  }
+
+  mesh_lod_t lod = {
+      .first_index = packed_indices->count,
+      .index_count = index_count,
+      .vertex_offset = (int32_t)packed_vertices->count,
+      .vertex_count = vertex_count,
+      .acmr = simulate_vertex_cache(indices, index_count, vertex_count),
+  };
+
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    da_append((*packed_vertices), pack_vertex(&vertices[v]));
+  }
+  for (uint32_t i = 0; i < index_count; i++) {
+    da_append((*packed_indices), (uint16_t)indices[i]);
+  }
+
+  return lod;
+}
+
+// Build every shape with its LOD chain into scene->meshes and upload the
+// shared vertex and index buffers
+void load_meshes(app_t *app) {
+  scene_t *scene = &app->scene;
+  mesh_stats_t *stats = &scene->mesh_stats;
+  packed_vertices_da_t packed_vertices = {0};
+  uint16_da_t packed_indices = {0};
+  uint32_t lod0_triangles = 0;
+
+  for (uint32_t shape = 0; shape < MESH_SHAPE_COUNT; shape++) {
+    mesh_vertex_t *source;
+    uint32_t source_count = generate_mesh_soup(shape, &source);
+    uint32_t *source_indices = malloc(source_count * sizeof(uint32_t));
+    uint32_t unique =
+        deduplicate_vertices(source, source_count, source_indices);
+
+    stats->source_vertices += source_count;
+    stats->unique_vertices += unique;
+    stats->acmr_before +=
+        simulate_vertex_cache(source_indices, source_count, unique) *
+        (source_count / 3);
+    lod0_triangles += source_count / 3;
+
+    mesh_vertex_t *vertices = malloc(unique * sizeof(mesh_vertex_t));
+    uint32_t *indices = malloc(source_count * sizeof(uint32_t));
+    mesh_t mesh = {0};
+
+    for (uint32_t level = 0; level < MESH_MAX_LODS; level++) {
+      memcpy(vertices, source, unique * sizeof(mesh_vertex_t));
+      uint32_t index_count = source_count;
+
+      if (level == 0) {
+        memcpy(indices, source_indices, source_count * sizeof(uint32_t));
+      } else {
+        index_count =
+            simplify_mesh(source, unique, source_indices, source_count,
+                          MESH_LOD_CELLS >> (level - 1), indices);
+
+        // Not worth a level of its own
+        mesh_lod_t *previous = &mesh.lods[mesh.lod_count - 1];
+        if (index_count / 3 < MESH_LOD_MIN_TRIANGLES ||
+            index_count * 4 > previous->index_count * 3) {
+          break;
+        }
+      }
+
+      mesh.lods[mesh.lod_count++] =
+          append_mesh_lod(vertices, unique, indices, index_count,
+                          &packed_vertices, &packed_indices);
+    }
+
+    stats->acmr_after += mesh.lods[0].acmr * (mesh.lods[0].index_count / 3);
+    stats->float_vertex_bytes += (VkDeviceSize)unique * sizeof(mesh_vertex_t);
+    da_append(scene->meshes, mesh);
+
+    free(indices);
+    free(vertices);
+    free(source_indices);
+    free(source);
+  }
+
+  stats->acmr_before /= lod0_triangles;
+  stats->acmr_after /= lod0_triangles;
+  stats->vertex_bytes = packed_vertices.count * sizeof(packed_vertex_t);
+  stats->index_bytes = packed_indices.count * sizeof(uint16_t);
+
+  upload_buffer(app, packed_vertices.items, stats->vertex_bytes,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &scene->mesh_vertex_buffer,
+                &scene->mesh_vertex_memory);
+  upload_buffer(app, packed_indices.items, stats->index_bytes,
+                VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &scene->mesh_index_buffer,
+                &scene->mesh_index_memory);
+
+  printf("meshes: %llu source vertices -> %llu unique, ACMR %.2f -> %.2f, "
+         "%.1f KiB vertices + %.1f KiB indices (%.1f KiB unquantized LOD 0)\n",
+         (unsigned long long)stats->source_vertices,
+         (unsigned long long)stats->unique_vertices, stats->acmr_before,
+         stats->acmr_after, stats->vertex_bytes / 1024.0,
+         stats->index_bytes / 1024.0, stats->float_vertex_bytes / 1024.0);
+
+  da_free(packed_vertices);
+  da_free(packed_indices);
+}
+
+/*******
+ * Scene
+ *******/
+
+typedef struct {
+  float position[2];
+  float color[3];
+} scene_vertex_t;
+
+typedef struct {
+  float offset[2];
+} scene_instance_t;
+
+typedef struct {
+  uint8_t *items;
+  size_t count;
+  size_t capacity;
+} bytes_da_t;
+
+// splitmix64, so scenes are identical across platforms for a given seed
+uint64_t rng_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+float rng_float(uint64_t *state) {
+  return (float)(rng_next(state) >> 40) / (float)(1 << 24);
+}
+
+bytes_da_t read_file(const char *path) {
+  bytes_da_t contents = {0};
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    error("failed to open file %s!", path);
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  da_capacity(contents, size);
+  contents.count = fread(contents.items, 1, size, file);
+  fclose(file);
+
+  return contents;
+}
+
+VkShaderModule create_shader_module(app_t *app, const char *path) {
+  bytes_da_t code = read_file(path);
+
+  VkShaderModuleCreateInfo create_info = {0};
+  create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  create_info.codeSize = code.count;
+  create_info.pCode = (const uint32_t *)code.items;
+
+  VkShaderModule shader_module;
+  if (vkCreateShaderModule(app->device, &create_info, NULL, &shader_module) !=
+      VK_SUCCESS) {
+    error("failed to create shader module from %s!", path);
+  }
+
+  da_free(code);
+  return shader_module;
+}
+
+void create_scene_geometry(app_t *app, uint64_t *rng) {
+  scene_t *scene = &app->scene;
+
+  size_t vertex_count = (size_t)scene->desc.triangles * 3;
+  scene_vertex_t *vertices = malloc(vertex_count * sizeof(scene_vertex_t));
+
+  // Shrink triangles as the count goes up so coverage stays roughly constant
+  float size = 0.5f / sqrtf((float)scene->desc.triangles);
+  scene->triangle_size = size;
+  const float corners[3][2] = {{0.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+
+  for (uint32_t i = 0; i < scene->desc.triangles; i++) {
+    float center[2] = {0.0f, 0.0f};
+    if (scene->desc.triangles > 1) {
+      center[0] = rng_float(rng) * 2.0f - 1.0f;
+      center[1] = rng_float(rng) * 2.0f - 1.0f;
+    }
+
+    for (uint32_t j = 0; j < 3; j++) {
+      scene_vertex_t *vertex = &vertices[i * 3 + j];
+      vertex->position[0] = center[0] + corners[j][0] * size;
+      vertex->position[1] = center[1] + corners[j][1] * size;
+      vertex->color[0] = rng_float(rng);
+      vertex->color[1] = rng_float(rng);
+      vertex->color[2] = rng_float(rng);
+    }
+  }
+
+  upload_buffer(app, vertices, vertex_count * sizeof(scene_vertex_t),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &scene->vertex_buffer,
+                &scene->vertex_memory);
+  free(vertices);
+
+  scene_instance_t *instances =
+      malloc(scene->desc.instances * sizeof(scene_instance_t));
+
+  for (uint32_t i = 0; i < scene->desc.instances; i++) {
+    instances[i] = (scene_instance_t){0};
+    if (scene->desc.instances > 1) {
+      instances[i].offset[0] = rng_float(rng) - 0.5f;
+      instances[i].offset[1] = rng_float(rng) - 0.5f;
+    }
+  }
+
+  upload_buffer(app, instances,
+                scene->desc.instances * sizeof(scene_instance_t),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &scene->instance_buffer,
+                &scene->instance_memory);
+  free(instances);
+}
+
+void create_scene_textures(app_t *app, uint64_t *rng) {
+  scene_t *scene = &app->scene;
+
+  for (uint32_t i = 0; i < scene->desc.textures; i++) {
+    texture_t texture = {0};
+
+    for (uint32_t c = 0; c < 2; c++) {
+      for (uint32_t channel = 0; channel < 3; channel++) {
+        texture.colors[c][channel] = 128 + (uint8_t)(rng_float(rng) * 127.0f);
+      }
+      texture.colors[c][3] = 255;
+    }
+
+    da_append(scene->textures, texture);
+  }
+
+  texture_streaming_t *streaming = &app->streaming;
+  measure_texture_images(app);
+  update_texture_budget(app);
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    create_texture_staging(app, TEXTURE_STAGING_BYTES_PER_FRAME,
+                           &streaming->staging[i]);
+  }
+
+  // Only the always-resident low mips are loaded before the first frame, in
+  // a single submission from one staging buffer
+  VkDeviceSize load_bytes =
+      texture_chain_bytes(texture_floor_mip()) * scene->textures.count;
+  texture_staging_t load_staging;
+  create_texture_staging(app, load_bytes > 0 ? load_bytes : 1, &load_staging);
+
+  VkCommandBuffer command_buffer = begin_single_time_commands(app);
+  for (uint32_t i = 0; i < scene->textures.count; i++) {
+    rebuild_texture(app, command_buffer, &scene->textures.items[i],
+                    texture_floor_mip(), &load_staging);
+  }
+  end_single_time_commands(app, command_buffer);
+  destroy_mapped_buffer(app, &load_staging.buffer);
+
+  VkSamplerCreateInfo sampler_info = {0};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_NEAREST;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.minLod = 0.0f;
+  sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(app->device, &sampler_info, NULL, &scene->sampler) !=
+      VK_SUCCESS) {
+    error("failed to create texture sampler!");
+  }
+}
+
+void create_scene_meshes(app_t *app, uint64_t *rng) {
+  scene_t *scene = &app->scene;
+
+  load_meshes(app);
+
+  // Mesh extent is 2 * scale in NDC, so the larger instances get LOD 0
+  for (uint32_t i = 0; i < scene->desc.meshes; i++) {
+    mesh_instance_t instance = {
+        .offset = {rng_float(rng) * 2.0f - 1.0f, rng_float(rng) * 2.0f - 1.0f},
+        .scale = 0.02f + rng_float(rng) * 0.28f,
+        .mesh = i % scene->meshes.count,
+    };
+    da_append(scene->mesh_instances, instance);
+  }
+
+  upload_buffer(app, scene->mesh_instances.items,
+                scene->mesh_instances.count * sizeof(mesh_instance_t),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                &scene->mesh_instance_buffer, &scene->mesh_instance_memory);
+
+  scene->mesh_vertex_shader =
+      create_shader_module(app, SHADER_DIR "/mesh.vert.spv");
+  scene->mesh_fragment_shader =
+      create_shader_module(app, SHADER_DIR "/mesh.frag.spv");
+
+  VkPipelineLayoutCreateInfo layout_info = {0};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+
+  if (vkCreatePipelineLayout(app->device, &layout_info, NULL,
+                             &scene->mesh_pipeline_layout) != VK_SUCCESS) {
+    error("failed to create pipeline layout!");
+  }
+
+  pipeline_key_t *key = &scene->mesh_pipeline_key;
+  pipeline_key_init(key);
+  key->vertex_shader = scene->mesh_vertex_shader;
+  key->fragment_shader = scene->mesh_fragment_shader;
+  key->layout = scene->mesh_pipeline_layout;
+  key->render_pass = app->render_pass;
+  key->color_format = app->swapchain_image_format;
+  // No depth buffer, overlap within a mesh resolves in index order
+  key->cull_mode = VK_CULL_MODE_NONE;
+  key->binding_count = 2;
+  key->bindings[0] = (VkVertexInputBindingDescription){
+      0, sizeof(packed_vertex_t), VK_VERTEX_INPUT_RATE_VERTEX};
+  key->bindings[1] = (VkVertexInputBindingDescription){
+      1, sizeof(mesh_instance_t), VK_VERTEX_INPUT_RATE_INSTANCE};
+  key->attribute_count = 5;
+  key->attributes[0] = (VkVertexInputAttributeDescription){
+      0, 0, VK_FORMAT_R16G16B16A16_SFLOAT, offsetof(packed_vertex_t, position)};
+  key->attributes[1] = (VkVertexInputAttributeDescription){
+      1, 0, VK_FORMAT_R16G16_SNORM, offsetof(packed_vertex_t, normal)};
+  key->attributes[2] = (VkVertexInputAttributeDescription){
+      2, 0, VK_FORMAT_R16G16_UNORM, offsetof(packed_vertex_t, uv)};
+  key->attributes[3] = (VkVertexInputAttributeDescription){
+      3, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(mesh_instance_t, offset)};
+  key->attributes[4] = (VkVertexInputAttributeDescription){
+      4, 1, VK_FORMAT_R32_SFLOAT, offsetof(mesh_instance_t, scale)};
+
+  pipeline_cache_request(&app->pipeline_cache, key);
+}
+
+void load_scene(app_t *app, scene_desc_t desc) {
+  scene_t *scene = &app->scene;
+  *scene = (scene_t){.desc = desc};
+  uint64_t rng = desc.seed;
+
+  scene->vertex_shader = create_shader_module(app, SHADER_DIR "/scene.vert.spv");
+  scene->fragment_shader =
+      create_shader_module(app, SHADER_DIR "/scene.frag.spv");
+
+  VkDescriptorSetLayoutBinding texture_binding = {0};
+  texture_binding.binding = 0;
+  texture_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  texture_binding.descriptorCount = 1;
+  texture_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  scene->set_layout = get_descriptor_set_layout(app, &texture_binding, 1);
+
+  VkPipelineLayoutCreateInfo layout_info = {0};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &scene->set_layout;
+
+  if (vkCreatePipelineLayout(app->device, &layout_info, NULL,
+                             &scene->pipeline_layout) != VK_SUCCESS) {
+    error("failed to create pipeline layout!");
+  }
+
+  create_scene_geometry(app, &rng);
+  create_scene_textures(app, &rng);
+
+  if (desc.meshes > 0) {
+    create_scene_meshes(app, &rng);
+  }
+
+  pipeline_key_t *key = &scene->pipeline_key;
+  pipeline_key_init(key);
+  key->vertex_shader = scene->vertex_shader;
+  key->fragment_shader = scene->fragment_shader;
+  key->layout = scene->pipeline_layout;
+  key->render_pass = app->render_pass;
+  key->color_format = app->swapchain_image_format;
+  // Scene triangles are scattered with arbitrary winding
+  key->cull_mode = VK_CULL_MODE_NONE;
+  key->binding_count = 2;
+  key->bindings[0] = (VkVertexInputBindingDescription){
+      0, sizeof(scene_vertex_t), VK_VERTEX_INPUT_RATE_VERTEX};
+  key->bindings[1] = (VkVertexInputBindingDescription){
+      1, sizeof(scene_instance_t), VK_VERTEX_INPUT_RATE_INSTANCE};
+  key->attribute_count = 3;
+  key->attributes[0] = (VkVertexInputAttributeDescription){
+      0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(scene_vertex_t, position)};
+  key->attributes[1] = (VkVertexInputAttributeDescription){
+      1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(scene_vertex_t, color)};
+  key->attributes[2] = (VkVertexInputAttributeDescription){
+      2, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(scene_instance_t, offset)};
+
+  // Everything the scene draws is compiled before the first frame
+  pipeline_cache_request(&app->pipeline_cache, key);
+  pipeline_cache_wait_idle(&app->pipeline_cache);
+}
+
+// One bind of the shared buffers, then a draw per instance at the LOD its
+// on-screen size calls for
+void draw_meshes(app_t *app, VkCommandBuffer command_buffer,
+                 VkExtent2D extent) {
+  scene_t *scene = &app->scene;
+  mesh_stats_t *stats = &scene->mesh_stats;
+
+  VkPipeline pipeline = pipeline_cache_get(
+      &app->pipeline_cache, &scene->mesh_pipeline_key, VK_NULL_HANDLE);
+  if (pipeline == VK_NULL_HANDLE) {
+    return;
+  }
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+  VkBuffer vertex_buffers[] = {scene->mesh_vertex_buffer,
+                               scene->mesh_instance_buffer};
+  VkDeviceSize offsets[] = {0, 0};
+  vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, offsets);
+  vkCmdBindIndexBuffer(command_buffer, scene->mesh_index_buffer, 0,
+                       VK_INDEX_TYPE_UINT16);
+
+  if (stats->frame_number != app->frame_number) {
+    stats->frame_number = app->frame_number;
+    stats->draws = 0;
+    stats->buffer_binds = 0;
+    stats->indices = 0;
+    stats->vertex_fetches = 0.0;
+  }
+  stats->buffer_binds += 2;
+
+  for (uint32_t i = 0; i < scene->mesh_instances.count; i++) {
+    mesh_instance_t *instance = &scene->mesh_instances.items[i];
+    mesh_t *mesh = &scene->meshes.items[instance->mesh];
+    float footprint = instance->scale * extent.width;
+
+    uint32_t level = 0;
+    float threshold = MESH_LOD_PIXELS;
+    while (level + 1 < mesh->lod_count && footprint < threshold) {
+      level++;
+      threshold /= 2.0f;
+    }
+
+    mesh_lod_t *lod = &mesh->lods[level];
+    vkCmdDrawIndexed(command_buffer, lod->index_count, 1, lod->first_index,
+                     lod->vertex_offset, i);
+
+    stats->draws++;
+    stats->indices += lod->index_count;
+    stats->vertex_fetches += lod->acmr * (lod->index_count / 3);
+  }
+}
+
+void draw_scene(app_t *app, VkCommandBuffer command_buffer,
+                VkExtent2D extent) {
+  scene_t *scene = &app->scene;
+
+  VkPipeline pipeline = pipeline_cache_get(
+      &app->pipeline_cache, &scene->pipeline_key, VK_NULL_HANDLE);
+  if (pipeline == VK_NULL_HANDLE) {
+    return;
+  }
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+  VkBuffer vertex_buffers[] = {scene->vertex_buffer, scene->instance_buffer};
+  VkDeviceSize offsets[] = {0, 0};
+  vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, offsets);
+
+  // Each triangle spans 2 * triangle_size of the 2 unit wide viewport, and
+  // maps the whole texture
+  float footprint = scene->triangle_size * extent.width;
+
+  for (uint32_t i = 0; i < scene->desc.draws; i++) {
+    uint32_t first_triangle =
+        (uint64_t)i * scene->desc.triangles / scene->desc.draws;
+    uint32_t last_triangle =
+        (uint64_t)(i + 1) * scene->desc.triangles / scene->desc.draws;
+
+    if (first_triangle == last_triangle) {
+      continue;
+    }
+
+    texture_t *texture = &scene->textures.items[i % scene->textures.count];
+    mark_texture_used(app, texture, footprint);
+
+    if (texture->descriptor_set == VK_NULL_HANDLE) {
+      descriptor_write_t write = texture_descriptor_write(app, texture->view);
+      texture->descriptor_set =
+          get_immutable_descriptor_set(app, scene->set_layout, &write, 1);
+    }
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            scene->pipeline_layout, 0, 1,
+                            &texture->descriptor_set, 0, NULL);
+    vkCmdDraw(command_buffer, (last_triangle - first_triangle) * 3,
+              scene->desc.instances, first_triangle * 3, 0);
+  }
+
+  if (scene->desc.meshes > 0) {
+    draw_meshes(app, command_buffer, extent);
+  }
+}
+
+void destroy_scene(app_t *app) {
+  scene_t *scene = &app->scene;
+
+  for (uint32_t i = 0; i < scene->textures.count; i++) {
+    texture_t *texture = &scene->textures.items[i];
+    vkDestroyImageView(app->device, texture->view, NULL);
+    vkDestroyImage(app->device, texture->image, NULL);
+  }
+  da_free(scene->textures);
+
+  texture_streaming_t *streaming = &app->streaming;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    destroy_mapped_buffer(app, &streaming->staging[i].buffer);
+  }
+
+  printf("texture streaming: %.1f of %.1f MiB resident in %.1f MiB of "
+         "blocks, %llu uploads (%.1f MiB), %llu evictions\n",
+         streaming->resident_bytes / 1048576.0,
+         streaming->budget / 1048576.0, streaming->block_bytes / 1048576.0,
+         (unsigned long long)streaming->uploads,
+         streaming->uploaded_bytes / 1048576.0,
+         (unsigned long long)streaming->evictions);
+  destroy_texture_blocks(app);
+
+  vkDestroySampler(app->device, scene->sampler, NULL);
+  vkDestroyBuffer(app->device, scene->vertex_buffer, NULL);
+  free_memory(app, scene->vertex_memory);
+  vkDestroyBuffer(app->device, scene->instance_buffer, NULL);
+  free_memory(app, scene->instance_memory);
+  vkDestroyPipelineLayout(app->device, scene->pipeline_layout, NULL);
+  vkDestroyShaderModule(app->device, scene->vertex_shader, NULL);
+  vkDestroyShaderModule(app->device, scene->fragment_shader, NULL);
+
+  da_free(scene->meshes);
+  da_free(scene->mesh_instances);
+  vkDestroyBuffer(app->device, scene->mesh_vertex_buffer, NULL);
+  free_memory(app, scene->mesh_vertex_memory);
+  vkDestroyBuffer(app->device, scene->mesh_index_buffer, NULL);
+  free_memory(app, scene->mesh_index_memory);
+  vkDestroyBuffer(app->device, scene->mesh_instance_buffer, NULL);
+  free_memory(app, scene->mesh_instance_memory);
+  vkDestroyPipelineLayout(app->device, scene->mesh_pipeline_layout, NULL);
+  vkDestroyShaderModule(app->device, scene->mesh_vertex_shader, NULL);
+  vkDestroyShaderModule(app->device, scene->mesh_fragment_shader, NULL);
+}
+
+/***********
+ * Telemetry
+ ***********/
+
+// The frame loop pushes one sample per frame into a lock-free ring. A worker
+// drains it into histograms and serves the result in the Prometheus text
+// format, on a Unix socket to anyone who connects and/or rewritten into a
+// file every interval for node_exporter's textfile collector.
+
+#define TELEMETRY_POLL_MS 50
+
+const double telemetry_buckets_seconds[TELEMETRY_HISTOGRAM_BUCKETS] = {
+    0.001, 0.002, 0.004, 0.008, 0.0167, 0.0333, 0.0667, 0.1, 0.25};
+
+// Frame loop only, called once the frame's fence has been waited on
+void telemetry_record_frame(app_t *app) {
+  telemetry_t *telemetry = &app->telemetry;
+
+  if (!telemetry->enabled) {
+    return;
+  }
+
+  double now = now_ms();
+  double cpu_frame_ms = now - telemetry->last_frame_ms;
+  bool first_frame = telemetry->last_frame_ms == 0.0;
+  telemetry->last_frame_ms = now;
+  if (first_frame) {
+    return;
+  }
+
+  uint64_t head = atomic_load_explicit(&telemetry->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&telemetry->tail, memory_order_acquire);
+  if (head - tail >= TELEMETRY_RING_CAPACITY) {
+    // The worker is behind, never stall the frame for it
+    atomic_fetch_add_explicit(&telemetry->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  telemetry_sample_t *sample =
+      &telemetry->ring[head & (TELEMETRY_RING_CAPACITY - 1)];
+  sample->frame_number = app->frame_number;
+  sample->time_ms = now;
+  sample->cpu_frame_ms = cpu_frame_ms;
+  sample->gpu_frame_ms = app->last_gpu_frame_ms;
+  memcpy(sample->memory_bytes, app->memory.bytes, sizeof(sample->memory_bytes));
+  memcpy(sample->memory_allocations, app->memory.allocations,
+         sizeof(sample->memory_allocations));
+  sample->descriptor_pools_created = app->descriptors.pools_created;
+  sample->descriptor_pools_in_use = descriptor_pools_in_use(app);
+  sample->descriptor_sets_cached = app->descriptors.immutable_sets_live;
+  sample->pipeline_hits = app->pipeline_cache.hits;
+  sample->pipeline_misses = app->pipeline_cache.misses;
+  sample->uploaded_bytes = app->memory.uploaded_bytes;
+
+  atomic_store_explicit(&telemetry->head, head + 1, memory_order_release);
+}
+
+void telemetry_histogram_add(telemetry_histogram_t *histogram, double ms) {
+  double seconds = ms / 1000.0;
+
+  for (uint32_t i = 0; i < TELEMETRY_HISTOGRAM_BUCKETS; i++) {
+    if (seconds <= telemetry_buckets_seconds[i]) {
+      histogram->buckets[i]++;
+      break;
+    }
+  }
+
+  histogram->count++;
+  histogram->sum_seconds += seconds;
+}
+
+// Worker only
+void telemetry_drain(telemetry_t *telemetry) {
+  uint64_t tail = atomic_load_explicit(&telemetry->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&telemetry->head, memory_order_acquire);
+
+  for (; tail != head; tail++) {
+    telemetry_sample_t *sample =
+        &telemetry->ring[tail & (TELEMETRY_RING_CAPACITY - 1)];
+
+    telemetry_histogram_add(&telemetry->cpu_frame, sample->cpu_frame_ms);
+    if (sample->gpu_frame_ms >= 0.0) {
+      telemetry_histogram_add(&telemetry->gpu_frame, sample->gpu_frame_ms);
+    }
+    telemetry->latest = *sample;
+    telemetry->frames++;
+  }
+
+  atomic_store_explicit(&telemetry->tail, tail, memory_order_release);
+}
+
+// Upload bandwidth averaged over the last interval
+void telemetry_update_rates(telemetry_t *telemetry, double now) {
+  double elapsed_ms = now - telemetry->rate_time_ms;
+  uint64_t uploaded = telemetry->latest.uploaded_bytes;
+
+  if (elapsed_ms > 0.0) {
+    telemetry->upload_bytes_per_second =
+        (uploaded - telemetry->rate_uploaded_bytes) / (elapsed_ms / 1000.0);
+  }
+
+  telemetry->rate_time_ms = now;
+  telemetry->rate_uploaded_bytes = uploaded;
+}
+
+void write_telemetry_histogram(FILE *out, const char *name, const char *help,
+                               const telemetry_histogram_t *histogram) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+  uint64_t cumulative = 0;
+  for (uint32_t i = 0; i < TELEMETRY_HISTOGRAM_BUCKETS; i++) {
+    cumulative += histogram->buckets[i];
+    fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name,
+            telemetry_buckets_seconds[i], (unsigned long long)cumulative);
+  }
+
+  fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+          (unsigned long long)histogram->count);
+  fprintf(out, "%s_sum %.6f\n", name, histogram->sum_seconds);
+  fprintf(out, "%s_count %llu\n", name, (unsigned long long)histogram->count);
+}
+
+void write_telemetry(FILE *out, telemetry_t *telemetry) {
+  telemetry_sample_t *latest = &telemetry->latest;
+
+  fprintf(out, "# HELP vk_frames_total Frames rendered.\n"
+               "# TYPE vk_frames_total counter\n"
+               "vk_frames_total %llu\n",
+          (unsigned long long)telemetry->frames);
+
+  write_telemetry_histogram(out, "vk_frame_cpu_seconds",
+                            "CPU time from one frame start to the next.",
+                            &telemetry->cpu_frame);
+  write_telemetry_histogram(
+      out, "vk_frame_gpu_seconds",
+      "GPU time of the frame's command buffer, from timestamp queries.",
+      &telemetry->gpu_frame);
+
+  fprintf(out, "# HELP vk_memory_allocated_bytes Device memory allocated.\n"
+               "# TYPE vk_memory_allocated_bytes gauge\n");
+  for (uint32_t i = 0; i < telemetry->memory_type_count; i++) {
+    fprintf(out, "vk_memory_allocated_bytes{type=\"%u\",heap=\"%u\"} %llu\n",
+            i, telemetry->memory_heaps[i],
+            (unsigned long long)latest->memory_bytes[i]);
+  }
+
+  fprintf(out, "# HELP vk_memory_allocations Live device memory "
+               "allocations.\n"
+               "# TYPE vk_memory_allocations gauge\n");
+  for (uint32_t i = 0; i < telemetry->memory_type_count; i++) {
+    fprintf(out, "vk_memory_allocations{type=\"%u\",heap=\"%u\"} %u\n", i,
+            telemetry->memory_heaps[i], latest->memory_allocations[i]);
+  }
+
+  fprintf(out,
+          "# HELP vk_descriptor_pools_created_total Descriptor pools "
+          "created.\n"
+          "# TYPE vk_descriptor_pools_created_total counter\n"
+          "vk_descriptor_pools_created_total %u\n"
+          "# HELP vk_descriptor_pools_in_use Descriptor pools backing the "
+          "immutable set cache.\n"
+          "# TYPE vk_descriptor_pools_in_use gauge\n"
+          "vk_descriptor_pools_in_use %u\n"
+          "# HELP vk_descriptor_sets_cached Immutable descriptor sets held "
+          "by the set cache.\n"
+          "# TYPE vk_descriptor_sets_cached gauge\n"
+          "vk_descriptor_sets_cached %u\n",
+          latest->descriptor_pools_created, latest->descriptor_pools_in_use,
+          latest->descriptor_sets_cached);
+
+  uint64_t lookups = latest->pipeline_hits + latest->pipeline_misses;
+  fprintf(out,
+          "# HELP vk_pipeline_cache_hits_total Pipeline lookups that found "
+          "a compiled pipeline.\n"
+          "# TYPE vk_pipeline_cache_hits_total counter\n"
+          "vk_pipeline_cache_hits_total %llu\n"
+          "# HELP vk_pipeline_cache_misses_total Pipeline lookups that found "
+          "no compiled pipeline and used the fallback.\n"
+          "# TYPE vk_pipeline_cache_misses_total counter\n"
+          "vk_pipeline_cache_misses_total %llu\n"
+          "# HELP vk_pipeline_cache_hit_ratio Hits over all lookups so far.\n"
+          "# TYPE vk_pipeline_cache_hit_ratio gauge\n"
+          "vk_pipeline_cache_hit_ratio %.4f\n",
+          (unsigned long long)latest->pipeline_hits,
+          (unsigned long long)latest->pipeline_misses,
+          lookups > 0 ? (double)latest->pipeline_hits / lookups : 1.0);
+
+  fprintf(out,
+          "# HELP vk_upload_bytes_total Bytes copied to the device through "
+          "staging buffers.\n"
+          "# TYPE vk_upload_bytes_total counter\n"
+          "vk_upload_bytes_total %llu\n"
+          "# HELP vk_upload_bytes_per_second Upload bandwidth over the last "
+          "interval.\n"
+          "# TYPE vk_upload_bytes_per_second gauge\n"
+          "vk_upload_bytes_per_second %.1f\n",
+          (unsigned long long)latest->uploaded_bytes,
+          telemetry->upload_bytes_per_second);
+
+  fprintf(out,
+          "# HELP vk_telemetry_dropped_total Samples dropped with the ring "
+          "full.\n"
+          "# TYPE vk_telemetry_dropped_total counter\n"
+          "vk_telemetry_dropped_total %llu\n",
+          (unsigned long long)atomic_load(&telemetry->dropped));
+}
+
+// Written next to the target and renamed over it, so scrapers never see a
+// partial file
+void write_telemetry_file(telemetry_t *telemetry) {
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", telemetry->file_path);
+
+  FILE *out = fopen(tmp_path, "w");
+  if (out == NULL) {
+    return;
+  }
+
+  write_telemetry(out, telemetry);
+
+  if (fclose(out) == 0) {
+    rename(tmp_path, telemetry->file_path);
+  }
+}
+
+// Each connection gets the current metrics and is closed, e.g.
+// `socat - UNIX-CONNECT:PATH`
+void serve_telemetry_client(telemetry_t *telemetry) {
+  int client = accept(telemetry->listen_fd, NULL, NULL);
+  if (client < 0) {
+    return;
+  }
+
+  char *text = NULL;
+  size_t length = 0;
+  FILE *out = open_memstream(&text, &length);
+  write_telemetry(out, telemetry);
+  fclose(out);
+
+  // A client that hangs up early must not raise SIGPIPE
+  size_t sent = 0;
+  while (sent < length) {
+    ssize_t result = send(client, text + sent, length - sent, MSG_NOSIGNAL);
+    if (result <= 0) {
+      break;
+    }
+    sent += result;
+  }
+
+  free(text);
+  close(client);
+}
+
+void *telemetry_worker(void *arg) {
+  telemetry_t *telemetry = arg;
+  telemetry->rate_time_ms = now_ms();
+
+  while (atomic_load_explicit(&telemetry->running, memory_order_acquire)) {
+    telemetry_drain(telemetry);
+
+    double now = now_ms();
+    if (now - telemetry->rate_time_ms >= telemetry->interval_ms) {
+      telemetry_update_rates(telemetry, now);
+      if (telemetry->file_path != NULL) {
+        write_telemetry_file(telemetry);
+      }
+    }
+
+    if (telemetry->listen_fd >= 0) {
+      struct pollfd listener = {.fd = telemetry->listen_fd, .events = POLLIN};
+      if (poll(&listener, 1, TELEMETRY_POLL_MS) > 0) {
+        serve_telemetry_client(telemetry);
+      }
+    } else {
+      struct timespec interval = {0, TELEMETRY_POLL_MS * 1000000};
+      nanosleep(&interval, NULL);
+    }
+  }
+
+  telemetry_drain(telemetry);
+  telemetry_update_rates(telemetry, now_ms());
+  if (telemetry->file_path != NULL) {
+    write_telemetry_file(telemetry);
+  }
+
+  return NULL;
+}
+
+int create_telemetry_socket(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    error("telemetry socket path %s is too long!", path);
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    error("failed to create telemetry socket!");
+  }
+
+  // Left behind by a previous run that didn't shut down cleanly
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, 4) != 0) {
+    error("failed to listen on telemetry socket %s!", path);
+  }
+
+  return fd;
+}
+
+void create_telemetry(app_t *app) {
+  telemetry_t *telemetry = &app->telemetry;
+
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(app->physical_device, &memory_properties);
+  telemetry->memory_type_count = memory_properties.memoryTypeCount;
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+    telemetry->memory_heaps[i] = memory_properties.memoryTypes[i].heapIndex;
+  }
+
+  telemetry->ring =
+      calloc(TELEMETRY_RING_CAPACITY, sizeof(telemetry_sample_t));
+  atomic_init(&telemetry->head, 0);
+  atomic_init(&telemetry->tail, 0);
+  atomic_init(&telemetry->dropped, 0);
+  atomic_init(&telemetry->running, true);
+
+  telemetry->listen_fd = -1;
+  if (telemetry->socket_path != NULL) {
+    telemetry->listen_fd = create_telemetry_socket(telemetry->socket_path);
+  }
+
+  if (pthread_create(&telemetry->worker, NULL, telemetry_worker, telemetry) !=
+      0) {
+    error("failed to start telemetry worker!");
+  }
+
+  telemetry->enabled = true;
+}
+
+void destroy_telemetry(app_t *app) {
+  telemetry_t *telemetry = &app->telemetry;
+
+  if (!telemetry->enabled) {
+    return;
+  }
+
+  atomic_store_explicit(&telemetry->running, false, memory_order_release);
+  pthread_join(telemetry->worker, NULL);
+
+  if (telemetry->listen_fd >= 0) {
+    close(telemetry->listen_fd);
+    unlink(telemetry->socket_path);
+  }
+
+  printf("telemetry: %llu frames sampled, %llu dropped\n",
+         (unsigned long long)telemetry->frames,
+         (unsigned long long)atomic_load(&telemetry->dropped));
+
+  free(telemetry->ring);
+  telemetry->enabled = false;
+}
+
+/*******
+ * Frame
+ *******/
+
+void record_window(app_t *app, VkCommandBuffer command_buffer,
+                   window_t *window) {
+  VkExtent2D extent = window->swapchain_extent;
+  VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+  VkRenderPassBeginInfo render_pass_info = {0};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_pass_info.renderPass = app->render_pass;
+  render_pass_info.framebuffer =
+      window->swapchain_framebuffers.items[window->image_index];
+  render_pass_info.renderArea.offset = (VkOffset2D){0, 0};
+  render_pass_info.renderArea.extent = extent;
+  render_pass_info.clearValueCount = 1;
+  render_pass_info.pClearValues = &clear_color;
+
+  vkCmdBeginRenderPass(command_buffer, &render_pass_info,
+                       VK_SUBPASS_CONTENTS_INLINE);
+
+  VkViewport viewport = {0};
+  viewport.width = (float)extent.width;
+  viewport.height = (float)extent.height;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+  VkRect2D scissor = {{0, 0}, extent};
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+  draw_scene(app, command_buffer, extent);
+
+  vkCmdEndRenderPass(command_buffer);
+}
+
+void record_command_buffer(app_t *app, VkCommandBuffer command_buffer) {
+  uint32_t frame = app->current_frame;
+
+  VkCommandBufferBeginInfo begin_info = {0};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+    error("failed to begin recording command buffer!");
+  }
+
+  update_texture_streaming(app, command_buffer);
+
+  if (app->timestamps_supported) {
+    vkCmdResetQueryPool(command_buffer, app->timestamp_pool, frame * 2, 2);
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        app->timestamp_pool, frame * 2);
+  }
+
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    record_window(app, command_buffer, &app->windows.items[i]);
+  }
+
+  record_capture(app, command_buffer, &app->windows.items[0]);
+
+  if (app->timestamps_supported) {
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        app->timestamp_pool, frame * 2 + 1);
+    app->timestamps_written[frame] = true;
+  }
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    error("failed to record command buffer!");
+  }
+}
+
+void draw_frame(app_t *app) {
+  uint32_t frame = app->current_frame;
+
+  vkWaitForFences(app->device, 1, &app->in_flight_fences[frame], VK_TRUE,
+                  UINT64_MAX);
+  app->frame_number++;
+
+  // Everything this frame slot used last time around is now idle
+  read_frame_timestamps(app, frame);
+  collect_captures(app, frame);
+  flush_deletion_queue(app, frame);
+  pipeline_cache_poll(&app->pipeline_cache);
+  telemetry_record_frame(app);
+
+  uint32_t window_count = app->windows.count;
+  VkSemaphore image_available[MAX_WINDOWS];
+  VkPipelineStageFlags wait_stages[MAX_WINDOWS];
+  VkSemaphore render_finished[MAX_WINDOWS];
+  VkSwapchainKHR swapchains[MAX_WINDOWS];
+  uint32_t image_indices[MAX_WINDOWS];
+
+  for (uint32_t i = 0; i < window_count; i++) {
+    window_t *window = &app->windows.items[i];
+    window->image_index = frame;
+
+    if (app->mode != APP_MODE_WINDOWED) {
+      continue;
+    }
+
+    VkResult result = vkAcquireNextImageKHR(
+        app->device, window->swapchain, UINT64_MAX,
+        window->image_available_semaphores[frame], VK_NULL_HANDLE,
+        &window->image_index);
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      error("failed to acquire swap chain image with status %d", result);
+    }
+
+    image_available[i] = window->image_available_semaphores[frame];
+    wait_stages[i] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    render_finished[i] =
+        window->render_finished_semaphores.items[window->image_index];
+    swapchains[i] = window->swapchain;
+    image_indices[i] = window->image_index;
+  }
+
+  vkResetFences(app->device, 1, &app->in_flight_fences[frame]);
+
+  VkCommandBuffer command_buffer = app->command_buffers[frame];
+  vkResetCommandBuffer(command_buffer, 0);
+  record_command_buffer(app, command_buffer);
+
+  VkSubmitInfo submit_info = {0};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    submit_info.waitSemaphoreCount = window_count;
+    submit_info.pWaitSemaphores = image_available;
+    submit_info.pWaitDstStageMask = wait_stages;
+    submit_info.signalSemaphoreCount = window_count;
+    submit_info.pSignalSemaphores = render_finished;
+  }
+
+  if (vkQueueSubmit(app->graphics_queue, 1, &submit_info,
+                    app->in_flight_fences[frame]) != VK_SUCCESS) {
+    error("failed to submit draw command buffer!");
+  }
+
+  // Every window goes out in one present, so they flip together and the
+  // driver is only entered once per frame
+  if (app->mode == APP_MODE_WINDOWED) {
+    VkResult results[MAX_WINDOWS];
+
+    VkPresentInfoKHR present_info = {0};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.waitSemaphoreCount = window_count;
+    present_info.pWaitSemaphores = render_finished;
+    present_info.swapchainCount = window_count;
+    present_info.pSwapchains = swapchains;
+    present_info.pImageIndices = image_indices;
+    present_info.pResults = results;
+
+    vkQueuePresentKHR(app->present_queue, &present_info);
+    for (uint32_t i = 0; i < window_count; i++) {
+      if (results[i] != VK_SUCCESS && results[i] != VK_SUBOPTIMAL_KHR) {
+        error("failed to present to window %u with status %d", i, results[i]);
+      }
+    }
+  }
+
+  app->current_frame = (app->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+/*********
+ * Compute
+ *********/
+
+// Batches of levels adjustments over packed RGBA8 pixels, standing in for
+// image processing jobs. Each batch fills a persistently mapped input
+// buffer, runs its dispatches and is read back from a mapped output buffer
+// once its timeline value is reached.
+
+#define COMPUTE_LOCAL_SIZE 256
+#define COMPUTE_BLACK 0.0625f
+#define COMPUTE_GAIN 1.25f
+// Output texels checked against the CPU reference per batch
+#define COMPUTE_VERIFY_SAMPLES 16
+
+typedef struct {
+  uint32_t offset;
+  uint32_t count;
+  float black;
+  float gain;
+} compute_push_constants_t;
+
+uint32_t compute_input_pixel(uint64_t batch, uint32_t i) {
+  return (uint32_t)(i * 2654435761u + batch * 40503u);
+}
+
+// CPU reference for shaders/levels.comp
+uint32_t compute_expected_pixel(uint32_t pixel) {
+  uint32_t out = pixel & 0xff000000u;
+
+  for (uint32_t channel = 0; channel < 3; channel++) {
+    float value = ((pixel >> (channel * 8)) & 0xff) / 255.0f;
+    value = (value - COMPUTE_BLACK) * COMPUTE_GAIN;
+    value = clamp(value, 0.0f, 1.0f);
+    out |= (uint32_t)lrintf(value * 255.0f) << (channel * 8);
+  }
+
+  return out;
+}
+
+// Allow one step of rounding difference per channel
+bool compute_pixels_match(uint32_t left, uint32_t right) {
+  for (uint32_t channel = 0; channel < 4; channel++) {
+    int a = (left >> (channel * 8)) & 0xff;
+    int b = (right >> (channel * 8)) & 0xff;
+    if (abs(a - b) > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void wait_compute_timeline(app_t *app, uint64_t value) {
+  compute_t *compute = &app->compute;
+
+  VkSemaphoreWaitInfoKHR wait_info = {0};
+  wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &compute->timeline;
+  wait_info.pValues = &value;
+
+  if (compute->wait_semaphores(app->device, &wait_info, UINT64_MAX) !=
+      VK_SUCCESS) {
+    error("failed to wait for compute timeline!");
+  }
+}
+
+void verify_compute_slot(app_t *app, compute_slot_t *slot) {
+  compute_t *compute = &app->compute;
+  const uint32_t *output = slot->output.mapped;
+  uint32_t stride = compute->elements / COMPUTE_VERIFY_SAMPLES + 1;
+
+  for (uint32_t i = 0; i < compute->elements; i += stride) {
+    uint32_t expected =
+        compute_expected_pixel(compute_input_pixel(slot->batch, i));
+    if (!compute_pixels_match(output[i], expected)) {
+      compute->mismatches++;
+    }
+  }
+}
+
+void create_compute(app_t *app, uint32_t elements, uint32_t dispatches) {
+  compute_t *compute = &app->compute;
+  compute->elements = elements;
+  compute->dispatches = dispatches;
+
+  compute->wait_semaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(
+      app->device, "vkWaitSemaphoresKHR");
+  if (compute->wait_semaphores == NULL) {
+    error("failed to load vkWaitSemaphoresKHR!");
+  }
+
+  VkSemaphoreTypeCreateInfoKHR type_info = {0};
+  type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+  type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  type_info.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphore_info = {0};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_info.pNext = &type_info;
+
+  if (vkCreateSemaphore(app->device, &semaphore_info, NULL,
+                        &compute->timeline) != VK_SUCCESS) {
+    error("failed to create timeline semaphore!");
+  }
+
+  VkDescriptorSetLayoutBinding bindings[2] = {0};
+  for (uint32_t i = 0; i < 2; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayout set_layout =
+      get_descriptor_set_layout(app, bindings, 2);
+
+  VkPushConstantRange push_constants = {0};
+  push_constants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constants.size = sizeof(compute_push_constants_t);
+
+  VkPipelineLayoutCreateInfo layout_info = {0};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constants;
+
+  if (vkCreatePipelineLayout(app->device, &layout_info, NULL,
+                             &compute->pipeline_layout) != VK_SUCCESS) {
+    error("failed to create pipeline layout!");
+  }
+
+  compute->shader = create_shader_module(app, SHADER_DIR "/levels.comp.spv");
+
+  VkComputePipelineCreateInfo pipeline_info = {0};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = compute->shader;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.layout = compute->pipeline_layout;
+
+  // A single pipeline, so it skips the background compile queue but still
+  // goes through the persistent driver cache
+  if (vkCreateComputePipelines(app->device, app->pipeline_cache.vk_cache, 1,
+                               &pipeline_info, NULL,
+                               &compute->pipeline) != VK_SUCCESS) {
+    error("failed to create compute pipeline!");
+  }
+
+  VkDeviceSize size = (VkDeviceSize)elements * sizeof(uint32_t);
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    compute_slot_t *slot = &compute->slots[i];
+    create_mapped_buffer(app, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         &slot->input);
+    create_mapped_buffer(app, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         &slot->output);
+
+    descriptor_write_t writes[2] = {0};
+    writes[0].binding = 0;
+    writes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[0].buffer = (VkDescriptorBufferInfo){slot->input.buffer, 0, size};
+    writes[1].binding = 1;
+    writes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[1].buffer = (VkDescriptorBufferInfo){slot->output.buffer, 0, size};
+
+    slot->descriptor_set = get_immutable_descriptor_set(app, set_layout,
+                                                        writes, 2);
+  }
+}
+
+// Fill the next slot and submit its batch. Batches are chained through the
+// timeline, each waiting on the one before, so they complete in order and a
+// single counter value covers every earlier batch.
+void submit_compute_batch(app_t *app) {
+  compute_t *compute = &app->compute;
+  uint64_t batch = compute->submitted;
+  uint32_t slot_index = batch % MAX_FRAMES_IN_FLIGHT;
+  compute_slot_t *slot = &compute->slots[slot_index];
+
+  // Still owned by the batch submitted MAX_FRAMES_IN_FLIGHT ago
+  if (slot->timeline_value > 0) {
+    wait_compute_timeline(app, slot->timeline_value);
+    verify_compute_slot(app, slot);
+    slot->timeline_value = 0;
+  }
+
+  uint32_t *input = slot->input.mapped;
+  for (uint32_t i = 0; i < compute->elements; i++) {
+    input[i] = compute_input_pixel(batch, i);
+  }
+
+  VkCommandBuffer command_buffer = app->command_buffers[slot_index];
+  vkResetCommandBuffer(command_buffer, 0);
+
+  VkCommandBufferBeginInfo begin_info = {0};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+    error("failed to begin recording command buffer!");
+  }
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    compute->pipeline);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          compute->pipeline_layout, 0, 1,
+                          &slot->descriptor_set, 0, NULL);
+
+  // Dispatches cover disjoint ranges, so none need barriers between them
+  for (uint32_t i = 0; i < compute->dispatches; i++) {
+    uint32_t first = (uint64_t)i * compute->elements / compute->dispatches;
+    uint32_t last =
+        (uint64_t)(i + 1) * compute->elements / compute->dispatches;
+    if (first == last) {
+      continue;
+    }
+
+    compute_push_constants_t push_constants = {
+        .offset = first,
+        .count = last - first,
+        .black = COMPUTE_BLACK,
+        .gain = COMPUTE_GAIN,
+    };
+    vkCmdPushConstants(command_buffer, compute->pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants),
+                       &push_constants);
+    vkCmdDispatch(command_buffer,
+                  (last - first + COMPUTE_LOCAL_SIZE - 1) / COMPUTE_LOCAL_SIZE,
+                  1, 1);
+  }
+
+  // Make shader writes visible to the host once the timeline signals
+  VkMemoryBarrier barrier = {0};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0,
+                       NULL);
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    error("failed to record command buffer!");
+  }
+
+  uint64_t wait_value = batch;
+  uint64_t signal_value = batch + 1;
+  VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+  VkTimelineSemaphoreSubmitInfoKHR timeline_info = {0};
+  timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_info.waitSemaphoreValueCount = batch > 0 ? 1 : 0;
+  timeline_info.pWaitSemaphoreValues = &wait_value;
+  timeline_info.signalSemaphoreValueCount = 1;
+  timeline_info.pSignalSemaphoreValues = &signal_value;
+
+  VkSubmitInfo submit_info = {0};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_info;
+  submit_info.waitSemaphoreCount = batch > 0 ? 1 : 0;
+  submit_info.pWaitSemaphores = &compute->timeline;
+  submit_info.pWaitDstStageMask = &wait_stage;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &compute->timeline;
+
+  if (vkQueueSubmit(app->compute_queue, 1, &submit_info, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    error("failed to submit compute batch!");
+  }
+
+  slot->batch = batch;
+  slot->timeline_value = signal_value;
+  compute->submitted++;
+}
+
+// Wait for every submitted batch and check the ones not yet read back
+void finish_compute_batches(app_t *app) {
+  compute_t *compute = &app->compute;
+
+  if (compute->submitted > 0) {
+    wait_compute_timeline(app, compute->submitted);
+  }
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    compute_slot_t *slot = &compute->slots[i];
+    if (slot->timeline_value > 0) {
+      verify_compute_slot(app, slot);
+      slot->timeline_value = 0;
+    }
+  }
+}
+
+void destroy_compute(app_t *app) {
+  compute_t *compute = &app->compute;
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    destroy_mapped_buffer(app, &compute->slots[i].input);
+    destroy_mapped_buffer(app, &compute->slots[i].output);
+  }
+
+  vkDestroyPipeline(app->device, compute->pipeline, NULL);
+  vkDestroyShaderModule(app->device, compute->shader, NULL);
+  vkDestroyPipelineLayout(app->device, compute->pipeline_layout, NULL);
+  vkDestroySemaphore(app->device, compute->timeline, NULL);
+
+  if (compute->mismatches > 0) {
+    fprintf(stderr, "compute: %llu output mismatches\n",
+            (unsigned long long)compute->mismatches);
+  }
+}
+
+/***********
+ * Benchmark
+ ***********/
+
+typedef struct {
+  double *items;
+  size_t count;
+  size_t capacity;
+} doubles_da_t;
+
+typedef struct {
+  app_mode_t mode;
+  scene_desc_t scene;
+  // NULL unless running a benchmark
+  const char *bench_scene;
+  uint32_t bench_count;
+  uint32_t bench_frames;
+  const char *bench_output;
+  // 0 to derive the budget from the device
+  uint32_t texture_budget_mb;
+  uint32_t compute_dispatches;
+  const char *capture_directory;
+  const char *capture_raw;
+  uint32_t capture_every;
+  // Windows to open when not running a benchmark
+  uint32_t windows;
+  // NULL unless telemetry is wanted
+  const char *telemetry_socket;
+  const char *telemetry_file;
+  uint32_t telemetry_interval_ms;
+} app_config_t;
+
+long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+// Each preset scales one dimension of the scene with count
+bool scene_desc_from_preset(const char *name, uint32_t count, uint64_t seed,
+                            scene_desc_t *desc) {
+  *desc = (scene_desc_t){1, 1, 1, 1, 0, seed};
+
+  if (strcmp(name, "triangles") == 0) {
+    desc->triangles = count;
+  } else if (strcmp(name, "instances") == 0) {
+    desc->instances = count;
+  } else if (strcmp(name, "draws") == 0) {
+    desc->triangles = count;
+    desc->draws = count;
+  } else if (strcmp(name, "textures") == 0) {
+    desc->triangles = count;
+    desc->draws = count;
+    desc->textures = count;
+  } else if (strcmp(name, "meshes") == 0) {
+    desc->meshes = count;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+int compare_doubles(const void *left, const void *right) {
+  double a = *(const double *)left;
+  double b = *(const double *)right;
+  return (a > b) - (a < b);
+}
+
+// Expects samples to be sorted
+double percentile(doubles_da_t samples, double p) {
+  if (samples.count == 0) {
+    return 0.0;
+  }
+
+  size_t index = (size_t)(p / 100.0 * (samples.count - 1) + 0.5);
+  return samples.items[index];
+}
+
+void write_samples_json(FILE *out, const char *name, doubles_da_t samples) {
+  // qsort wants a valid pointer even for no samples
+  if (samples.count > 0) {
+    qsort(samples.items, samples.count, sizeof(double), compare_doubles);
+  }
+
+  double sum = 0.0;
+  for (size_t i = 0; i < samples.count; i++) {
+    sum += samples.items[i];
+  }
+
+  fprintf(out,
+          "  \"%s\": {\"samples\": %zu, \"mean\": %.4f, \"p50\": %.4f, "
+          "\"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+          name, samples.count, samples.count ? sum / samples.count : 0.0,
+          percentile(samples, 50), percentile(samples, 90),
+          percentile(samples, 99),
+          samples.count ? samples.items[samples.count - 1] : 0.0);
+}
+
+FILE *open_bench_output(const app_config_t *config) {
+  if (config->bench_output == NULL) {
+    return stdout;
+  }
+
+  FILE *out = fopen(config->bench_output, "w");
+  if (out == NULL) {
+    error("failed to open %s for writing!", config->bench_output);
+  }
+  return out;
+}
+
+// Fields shared by every benchmark, opens the JSON object
+void write_bench_header_json(FILE *out, app_t *app, const app_config_t *config,
+                             double startup_ms) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"scene\": \"%s\",\n", config->bench_scene);
+  fprintf(out, "  \"count\": %u,\n", config->bench_count);
+  fprintf(out, "  \"frames\": %u,\n", config->bench_frames);
+  fprintf(out, "  \"seed\": %llu,\n", (unsigned long long)config->scene.seed);
+  fprintf(out, "  \"device\": \"%s\",\n", properties.deviceName);
+  fprintf(out, "  \"startup_ms\": %.4f,\n", startup_ms);
+}
+
+void run_bench(app_t *app, const app_config_t *config, double startup_ms) {
+  doubles_da_t cpu_frame_ms = {0};
+  doubles_da_t gpu_frame_ms = {0};
+  da_capacity(cpu_frame_ms, config->bench_frames);
+  da_capacity(gpu_frame_ms, config->bench_frames);
+
+  for (uint32_t i = 0; i < config->bench_frames; i++) {
+    double frame_start = now_ms();
+    draw_frame(app);
+    da_append(cpu_frame_ms, now_ms() - frame_start);
+
+    if (app->last_gpu_frame_ms >= 0.0) {
+      da_append(gpu_frame_ms, app->last_gpu_frame_ms);
+    }
+  }
+
+  vkDeviceWaitIdle(app->device);
+
+  FILE *out = open_bench_output(config);
+  write_bench_header_json(out, app, config, startup_ms);
+
+  scene_desc_t desc = app->scene.desc;
+  fprintf(out,
+          "  \"triangles\": %u,\n  \"instances\": %u,\n  \"draws\": %u,\n"
+          "  \"textures\": %u,\n  \"meshes\": %u,\n",
+          desc.triangles, desc.instances, desc.draws, desc.textures,
+          desc.meshes);
+
+  if (desc.meshes > 0) {
+    mesh_stats_t *stats = &app->scene.mesh_stats;
+    fprintf(out, "  \"source_vertices\": %llu,\n",
+            (unsigned long long)stats->source_vertices);
+    fprintf(out, "  \"unique_vertices\": %llu,\n",
+            (unsigned long long)stats->unique_vertices);
+    fprintf(out, "  \"acmr_before\": %.4f,\n", stats->acmr_before);
+    fprintf(out, "  \"acmr_after\": %.4f,\n", stats->acmr_after);
+    fprintf(out, "  \"vertex_buffer_bytes\": %llu,\n",
+            (unsigned long long)stats->vertex_bytes);
+    fprintf(out, "  \"index_buffer_bytes\": %llu,\n",
+            (unsigned long long)stats->index_bytes);
+    fprintf(out, "  \"draws_per_frame\": %u,\n", stats->draws);
+    fprintf(out, "  \"buffer_binds_per_frame\": %u,\n",
+            stats->buffer_binds);
+    fprintf(out, "  \"indices_per_frame\": %llu,\n",
+            (unsigned long long)stats->indices);
+    fprintf(out, "  \"vertex_fetch_bytes_per_frame\": %.0f,\n",
+            stats->vertex_fetches * sizeof(packed_vertex_t));
+    fprintf(out, "  \"unquantized_vertex_fetch_bytes_per_frame\": %.0f,\n",
+            stats->vertex_fetches * sizeof(mesh_vertex_t));
+    fprintf(out, "  \"index_fetch_bytes_per_frame\": %llu,\n",
+            (unsigned long long)(stats->indices * sizeof(uint16_t)));
+  }
+
+  write_samples_json(out, "cpu_frame_ms", cpu_frame_ms);
+  fprintf(out, ",\n");
+  write_samples_json(out, "gpu_frame_ms", gpu_frame_ms);
+  fprintf(out, ",\n");
+  fprintf(out, "  \"peak_rss_kb\": %ld\n", peak_rss_kb());
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  da_free(cpu_frame_ms);
+  da_free(gpu_frame_ms);
+}
+
+// frames is the number of batches, count the pixels in each
+void run_compute_bench(app_t *app, const app_config_t *config,
+                       double startup_ms) {
+  compute_t *compute = &app->compute;
+  doubles_da_t batch_ms = {0};
+  da_capacity(batch_ms, config->bench_frames);
+
+  double start_ms = now_ms();
+  for (uint32_t i = 0; i < config->bench_frames; i++) {
+    double batch_start = now_ms();
+    submit_compute_batch(app);
+    da_append(batch_ms, now_ms() - batch_start);
+  }
+  finish_compute_batches(app);
+  double total_ms = now_ms() - start_ms;
+
+  double elements = (double)compute->elements * config->bench_frames;
+  // Every pixel is read once and written once
+  double bytes = elements * 2 * sizeof(uint32_t);
+
+  FILE *out = open_bench_output(config);
+  write_bench_header_json(out, app, config, startup_ms);
+
+  fprintf(out, "  \"dispatches\": %u,\n", compute->dispatches);
+  fprintf(out, "  \"total_ms\": %.4f,\n", total_ms);
+  fprintf(out, "  \"ns_per_element\": %.4f,\n",
+          total_ms * 1e6 / elements);
+  fprintf(out, "  \"elements_per_second\": %.1f,\n",
+          elements / (total_ms / 1000.0));
+  fprintf(out, "  \"mb_per_second\": %.1f,\n",
+          bytes / 1048576.0 / (total_ms / 1000.0));
+  fprintf(out, "  \"mismatches\": %llu,\n",
+          (unsigned long long)compute->mismatches);
+  write_samples_json(out, "cpu_batch_ms", batch_ms);
+  fprintf(out, ",\n");
+  fprintf(out, "  \"peak_rss_kb\": %ld\n", peak_rss_kb());
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  da_free(batch_ms);
+}
+
+/************
+ * Main hooks
+ ************/
+
+void init_windows(app_t *app, uint32_t count) {
+  glfwInit();
+
+  // Don't create an OpenGL context
+  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+
+  for (uint32_t i = 0; i < count; i++) {
+    char title[32] = "Vulkan";
+    if (count > 1) {
+      snprintf(title, sizeof(title), "Vulkan %u", i + 1);
+    }
+
+    window_t window = {0};
+    window.window = glfwCreateWindow(WIDTH, HEIGHT, title, NULL, NULL);
+    if (window.window == NULL) {
+      error("failed to create window %u!", i + 1);
+    }
+    da_append(app->windows, window);
+  }
+}
+
+void init_vulkan(app_t *app) {
+  if (enable_validation_layers) {
+    create_logger(app);
+  }
+
+  create_instance(app);
+  setup_debug_messenger(app);
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    for (uint32_t i = 0; i < app->windows.count; i++) {
+      create_surface(app, &app->windows.items[i]);
+    }
+  }
+
+  pick_physical_device(app);
+  create_logical_device(app);
+
+  if (app->mode == APP_MODE_COMPUTE) {
+    create_command_pool(app);
+    create_pipeline_cache(app);
+    create_descriptor_allocator(app);
+    return;
+  }
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    for (uint32_t i = 0; i < app->windows.count; i++) {
+      create_swapchain(app, &app->windows.items[i]);
+    }
+  } else {
+    create_offscreen_targets(app);
+  }
+
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    create_image_views(app, &app->windows.items[i]);
+  }
+
+  create_render_pass(app);
+
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    create_framebuffers(app, &app->windows.items[i]);
+  }
+
+  create_command_pool(app);
+  create_sync_objects(app);
+  create_timestamp_pool(app);
+  create_pipeline_cache(app);
+  create_descriptor_allocator(app);
+
+  if (app->telemetry.socket_path != NULL ||
+      app->telemetry.file_path != NULL) {
+    create_telemetry(app);
+  }
+}
+
+// Every window shows the same frames, so closing any of them quits
+bool any_window_should_close(app_t *app) {
+  for (uint32_t i = 0; i < app->windows.count; i++) {
+    if (glfwWindowShouldClose(app->windows.items[i].window)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void main_loop(app_t *app) {
+  while (!any_window_should_close(app)) {
+    glfwPollEvents();
+    draw_frame(app);
+  }
+}
+
+void cleanup(app_t *app) {
+  vkDeviceWaitIdle(app->device);
+  destroy_telemetry(app);
+
+  if (app->mode == APP_MODE_COMPUTE) {
+    destroy_compute(app);
+  } else {
+    destroy_capture(app);
+    destroy_scene(app);
+  }
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    flush_deletion_queue(app, i);
+    da_free(app->deletion_queues[i]);
+  }
+
+  destroy_descriptor_allocator(app);
+  destroy_pipeline_cache(app);
+
+  if (app->timestamps_supported) {
+    vkDestroyQueryPool(app->device, app->timestamp_pool, NULL);
+  }
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroyFence(app->device, app->in_flight_fences[i], NULL);
+  }
+
+  vkDestroyCommandPool(app->device, app->command_pool, NULL);
+
+  for (uint32_t w = 0; w < app->windows.count; w++) {
+    window_t *window = &app->windows.items[w];
+
+    if (app->mode == APP_MODE_WINDOWED) {
+      for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroySemaphore(app->device, window->image_available_semaphores[i],
+                           NULL);
+      }
+    }
+
+    for (uint32_t i = 0; i < window->render_finished_semaphores.count; i++) {
+      vkDestroySemaphore(app->device,
+                         window->render_finished_semaphores.items[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < window->swapchain_framebuffers.count; i++) {
+      vkDestroyFramebuffer(app->device, window->swapchain_framebuffers.items[i],
+                           NULL);
+    }
+
+    for (uint32_t i = 0; i < window->swapchain_image_views.count; i++) {
+      vkDestroyImageView(app->device, window->swapchain_image_views.items[i],
+                         NULL);
+    }
+
+    if (app->mode == APP_MODE_WINDOWED) {
+      vkDestroySwapchainKHR(app->device, window->swapchain, NULL);
+    } else {
+      for (uint32_t i = 0; i < window->swapchain_images.count; i++) {
+        vkDestroyImage(app->device, window->swapchain_images.items[i], NULL);
+        free_memory(app, window->offscreen_memories.items[i]);
+      }
+    }
+  }
+
+  vkDestroyRenderPass(app->device, app->render_pass, NULL);
+
+  vkDestroyDevice(app->device, NULL);
+  free(app->memory.slots);
+
+  if (enable_validation_layers) {
+    destroy_debug_utils_messenger_ext(app->instance, app->debug_messenger,
+                                      NULL);
+  }
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    for (uint32_t i = 0; i < app->windows.count; i++) {
+      vkDestroySurfaceKHR(app->instance, app->windows.items[i].surface, NULL);
+    }
+  }
+
+  vkDestroyInstance(app->instance, NULL);
+
+  // After the instance, which can still report through its create-time
+  // messenger
+  if (enable_validation_layers) {
+    destroy_logger(app);
+  }
+
+  if (app->mode == APP_MODE_WINDOWED) {
+    for (uint32_t i = 0; i < app->windows.count; i++) {
+      glfwDestroyWindow(app->windows.items[i].window);
+    }
+    glfwTerminate();
+  }
+
+  da_free(app->windows);
+}
+
+void run(const app_config_t *config) {
+  double start_ms = now_ms();
+  app_t app = {.physical_device = VK_NULL_HANDLE, .mode = config->mode};
+  app.streaming.budget_override =
+      (VkDeviceSize)config->texture_budget_mb * 1024 * 1024;
+  app.telemetry.socket_path = config->telemetry_socket;
+  app.telemetry.file_path = config->telemetry_file;
+  app.telemetry.interval_ms = config->telemetry_interval_ms;
+
+  if (app.mode == APP_MODE_WINDOWED) {
+    init_windows(&app, config->windows);
+  }
+
+  init_vulkan(&app);
+
+  if (app.mode == APP_MODE_COMPUTE) {
+    create_compute(&app, config->bench_count, config->compute_dispatches);
+    run_compute_bench(&app, config, now_ms() - start_ms);
+    cleanup(&app);
+    return;
+  }
+
+  load_scene(&app, config->scene);
+  double startup_ms = now_ms() - start_ms;
+
+  if (config->capture_directory != NULL || config->capture_raw != NULL) {
+    create_capture(&app, config->capture_directory, config->capture_raw,
+                   config->capture_every);
+  }
+
+  if (config->bench_scene != NULL) {
+    run_bench(&app, config, startup_ms);
+  } else {
+    main_loop(&app);
+  }
+
+  cleanup(&app);
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--bench SCENE] [--count N] [--frames N] [--seed N] "
+          "[--output FILE]\n"
+          "          [--texture-budget MB] [--dispatches N] [--capture DIR]\n"
+          "          [--capture-raw FILE] [--capture-every N] [--windows N]\n"
+          "          [--telemetry-socket PATH] [--telemetry-file FILE]\n"
+          "          [--telemetry-interval MS]\n"
+          "\n"
+          "  --bench SCENE  render SCENE headless and print timings as JSON\n"
+          "                 (triangles, instances, draws, textures, meshes),\n"
+          "                 or run compute batches without any render\n"
+          "                 targets (compute)\n"
+          "  --count N      size of the benchmark scene, pixels per batch for\n"
+          "                 compute (default 1000)\n"
+          "  --frames N     frames to render or batches to run (default 300)\n"
+          "  --seed N       scene generation seed (default 1)\n"
+          "  --output FILE  write benchmark JSON to FILE instead of stdout\n"
+          "  --texture-budget MB\n"
+          "                 cap resident texture memory (default: half of\n"
+          "                 what the device reports as available)\n"
+          "  --dispatches N compute dispatches per batch (default 16)\n"
+          "  --capture DIR  save rendered frames to DIR as QOI images\n"
+          "  --capture-raw FILE\n"
+          "                 append rendered frames to FILE as raw RGBA8\n"
+          "  --capture-every N\n"
+          "                 capture every Nth frame (default 1)\n"
+          "  --windows N    open N windows showing the same scene, presented\n"
+          "                 together (default 1, at most %d)\n"
+          "  --telemetry-socket PATH\n"
+          "                 serve Prometheus metrics to each connection on a\n"
+          "                 Unix socket at PATH\n"
+          "  --telemetry-file FILE\n"
+          "                 rewrite FILE with Prometheus metrics every interval\n"
+          "  --telemetry-interval MS\n"
+          "                 metrics file and rate interval (default 1000)\n",
+          program, MAX_WINDOWS);
+}
+
+int main(int argc, char **argv) {
+  app_config_t config = {
+      .mode = APP_MODE_WINDOWED,
+      .bench_count = 1000,
+      .bench_frames = 300,
+      .compute_dispatches = 16,
+      .capture_every = 1,
+      .windows = 1,
+      .telemetry_interval_ms = 1000,
+  };
+  uint64_t seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--bench") == 0 && has_value) {
+      config.bench_scene = argv[++i];
+    } else if (strcmp(argv[i], "--count") == 0 && has_value) {
+      config.bench_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+      config.bench_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+      config.bench_output = argv[++i];
+    } else if (strcmp(argv[i], "--texture-budget") == 0 && has_value) {
+      config.texture_budget_mb = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--dispatches") == 0 && has_value) {
+      config.compute_dispatches = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+      config.capture_directory = argv[++i];
+    } else if (strcmp(argv[i], "--capture-raw") == 0 && has_value) {
+      config.capture_raw = argv[++i];
+    } else if (strcmp(argv[i], "--capture-every") == 0 && has_value) {
+      config.capture_every = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--windows") == 0 && has_value) {
+      config.windows = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--telemetry-socket") == 0 && has_value) {
+      config.telemetry_socket = argv[++i];
+    } else if (strcmp(argv[i], "--telemetry-file") == 0 && has_value) {
+      config.telemetry_file = argv[++i];
+    } else if (strcmp(argv[i], "--telemetry-interval") == 0 && has_value) {
+      config.telemetry_interval_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (config.capture_every == 0 || config.windows == 0 ||
+      config.windows > MAX_WINDOWS || config.telemetry_interval_ms == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // The windowed app draws the smallest scene, a single textured triangle
+  config.scene = (scene_desc_t){1, 1, 1, 1, 0, seed};
+
+  if (config.bench_scene != NULL &&
+      strcmp(config.bench_scene, "compute") == 0) {
+    config.mode = APP_MODE_COMPUTE;
+
+    // Telemetry samples frames, which compute mode doesn't have
+    if (config.bench_count == 0 || config.compute_dispatches == 0 ||
+        config.telemetry_socket != NULL || config.telemetry_file != NULL) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  } else if (config.bench_scene != NULL) {
+    config.mode = APP_MODE_HEADLESS;
+
+    if (config.bench_count == 0 ||
+        !scene_desc_from_preset(config.bench_scene, config.bench_count, seed,
+                                &config.scene)) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  run(&config);
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,15 @@
+#version 450
+
+layout(location = 0) in vec3 frag_normal;
+layout(location = 1) in vec2 frag_uv;
+
+layout(location = 0) out vec4 out_color;
+
+const vec3 light_direction = vec3(0.38, -0.55, 0.74);
+
+void main() {
+  float diffuse = max(dot(normalize(frag_normal), light_direction), 0.0);
+  // Stripes along u make uv precision loss visible
+  float stripe = 0.85 + 0.15 * step(0.5, fract(frag_uv.x * 16.0));
+  out_color = vec4(vec3(0.2 + 0.8 * diffuse) * stripe, 1.0);
+}
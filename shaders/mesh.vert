@@ -0,0 +1,25 @@
+#version 450
+
+// Quantized vertex layout, see packed_vertex_t
+layout(location = 0) in vec4 in_position;
+layout(location = 1) in vec2 in_normal;
+layout(location = 2) in vec2 in_uv;
+layout(location = 3) in vec2 in_offset;
+layout(location = 4) in float in_scale;
+
+layout(location = 0) out vec3 frag_normal;
+layout(location = 1) out vec2 frag_uv;
+
+vec3 decode_octahedral(vec2 encoded) {
+  vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  float fold = max(-normal.z, 0.0);
+  normal.x += normal.x >= 0.0 ? -fold : fold;
+  normal.y += normal.y >= 0.0 ? -fold : fold;
+  return normalize(normal);
+}
+
+void main() {
+  gl_Position = vec4(in_position.xy * in_scale + in_offset, 0.5, 1.0);
+  frag_normal = decode_octahedral(in_normal);
+  frag_uv = in_uv;
+}
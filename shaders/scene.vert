@@ -0,0 +1,19 @@
+#version 450
+
+layout(location = 0) in vec2 in_position;
+layout(location = 1) in vec3 in_color;
+layout(location = 2) in vec2 in_offset;
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_uv;
+
+// Every triangle maps the whole texture, so the footprint the CPU uses to
+// pick a mip level matches what gets sampled
+const vec2 corner_uvs[3] = vec2[](vec2(0.5, 0.0), vec2(1.0, 1.0),
+                                  vec2(0.0, 1.0));
+
+void main() {
+  gl_Position = vec4(in_position + in_offset, 0.0, 1.0);
+  frag_color = in_color;
+  frag_uv = corner_uvs[gl_VertexIndex % 3];
+}